@@ -3,17 +3,31 @@
 #include <algorithm>
 #include <vector>
 #include <tuple>
+#include <limits>
 
 #include <getopt.h>
 
 #include "core/sphere.h"
+#include "core/analysis.h"
+#include "core/cluster.h"
 #include "core/control.h"
+#include "core/ensemble.h"
 #include "core/file.h"
+#include "core/progress.h"
 
 #include "common/math_utils.cpp"
 
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && std::string{argv[1]} == "merge")
+    {
+        if (argc < 4)
+        {
+            std::cerr << "Use 'aggregate merge OUTPUT INPUT...'" << std::endl;
+            return -1;
+        }
+        return Agg::Ensemble::merge(argv[2], {argv + 3, argv + argc}) == 0 ? 0 : -1;
+    }
 
     static struct option long_options[] = {
         {"input", required_argument, NULL, 'i'},
@@ -24,12 +38,48 @@ int main(int argc, char *argv[])
         {"explrad", required_argument, NULL, 51},
         {"alpha", required_argument, NULL, 52},
         {"beta", required_argument, NULL, 53},
+        {"quantum", required_argument, NULL, 54},
+        {"morton", no_argument, NULL, 55},
+        {"cca", required_argument, NULL, 56},
+        {"sticking", required_argument, NULL, 57},
+        {"dla", no_argument, NULL, 58},
+        {"candidates", required_argument, NULL, 59},
+        {"layers", required_argument, NULL, 60},
+        {"points", required_argument, NULL, 61},
+        {"patience", required_argument, NULL, 62},
+        {"shrink", required_argument, NULL, 63},
+        {"budget", required_argument, NULL, 64},
+        {"minimizer", required_argument, NULL, 65},
+        {"seed", required_argument, NULL, 66},
+        {"ensemble", required_argument, NULL, 67},
+        {"shard", required_argument, NULL, 68},
+        {"lod", required_argument, NULL, 69},
+        {"progress", required_argument, NULL, 70},
+        {"status", required_argument, NULL, 71},
+        {"reorder", required_argument, NULL, 72},
+        {"analyze", required_argument, NULL, 73},
+        {"mem-limit", required_argument, NULL, 74},
         {"help", no_argument, NULL, 'h'},
         {0, 0, 0, 0}};
 
     bool file_input_provided = false, do_help = false, do_time = false, angle_provided = false;
     std::string file_output{"Aggregate.txt"}, file_input{}, file_spawn{};
-    double rad_root = 6.0, default_expl_rad = 50.0, alpha = 360.0, beta = 90.0;
+    double rad_root = 6.0, default_expl_rad = 50.0, alpha = 360.0, beta = 90.0, quantum = 0.01, lod = 0.0;
+    Agg::File::ArchiveOptions archive_options{};
+    Agg::Cluster::Parameters cca_params{};
+    bool cca_mode = false, dla_mode = false;
+    auto candidates = Agg::Control::Candidates::Random;
+    Agg::Control::SearchSettings search{};
+    auto minimizer = Agg::Control::Minimizer::Stochastic;
+    bool seed_provided = false;
+    std::uint64_t seed = 0, ensemble = 1;
+    Agg::Ensemble::Shard shard{};
+    double progress_interval = 10.0;
+    bool progress_provided = false;
+    std::string file_status{};
+    std::size_t reorder = 0;
+    double analysis_voxel = 0.0;
+    double mem_limit = 0.0;
 
     char c;
     while ((c = getopt_long(argc, argv, "f:i:s:o:rth", long_options, NULL)) !=
@@ -67,6 +117,108 @@ int main(int argc, char *argv[])
             beta = std::stod(optarg);
             angle_provided = true;
             break;
+        case 54:
+            quantum = std::stod(optarg);
+            break;
+        case 55:
+            archive_options.order = Agg::File::ArchiveOrder::Morton;
+            break;
+        case 56:
+            cca_params.box = std::stod(optarg);
+            cca_mode = true;
+            break;
+        case 57:
+            cca_params.sticking = std::stod(optarg);
+            break;
+        case 58:
+            dla_mode = true;
+            break;
+        case 59:
+            if (std::string{optarg} == "fibonacci")
+                candidates = Agg::Control::Candidates::Fibonacci;
+            else if (std::string{optarg} != "random")
+            {
+                std::cerr << "Unknown candidates '" << optarg << "', use random or fibonacci" << std::endl;
+                return 1;
+            }
+            break;
+        case 60:
+            search.nbLayer = std::stoi(optarg);
+            break;
+        case 61:
+            search.pointsLayer = std::stoi(optarg);
+            break;
+        case 62:
+            search.patience = std::stoi(optarg);
+            break;
+        case 63:
+            search.shrink = std::stod(optarg);
+            if (!(search.shrink > 0.0 && search.shrink <= 1.0))
+            {
+                std::cerr << "The shrink factor must lie in (0, 1]" << std::endl;
+                return 1;
+            }
+            break;
+        case 64:
+            search.budget = std::stoul(optarg);
+            break;
+        case 65:
+            if (std::string{optarg} == "rolling")
+                minimizer = Agg::Control::Minimizer::Rolling;
+            else if (std::string{optarg} != "stochastic")
+            {
+                std::cerr << "Unknown minimizer '" << optarg << "', use stochastic or rolling" << std::endl;
+                return 1;
+            }
+            break;
+        case 66:
+            seed = std::stoull(optarg);
+            seed_provided = true;
+            break;
+        case 67:
+            ensemble = std::stoull(optarg);
+            break;
+        case 68:
+            if (!Agg::Ensemble::parseShard(optarg, shard))
+            {
+                std::cerr << "Bad shard '" << optarg << "', use i/N with i < N" << std::endl;
+                return 1;
+            }
+            break;
+        case 69:
+            lod = std::stod(optarg);
+            break;
+        case 70:
+            progress_interval = std::stod(optarg);
+            progress_provided = true;
+            if (!(progress_interval > 0.0))
+            {
+                std::cerr << "The progress interval must be positive" << std::endl;
+                return 1;
+            }
+            break;
+        case 71:
+            file_status = optarg;
+            break;
+        case 72:
+            reorder = std::stoul(optarg);
+            break;
+        case 73:
+            analysis_voxel = std::stod(optarg);
+            if (!(analysis_voxel > 0.0))
+            {
+                std::cerr << "The voxel side of --analyze must be positive" << std::endl;
+                return 1;
+            }
+            break;
+        case 74:
+            mem_limit = std::stod(optarg);
+            if (!(mem_limit > 0.0))
+            {
+                std::cerr << "The memory limit must be positive" << std::endl;
+                return 1;
+            }
+            break;
         default:
             std::cerr << "Use '--help' or '-h' for usage " << std::endl;
             return 1;
@@ -88,6 +240,46 @@ int main(int argc, char *argv[])
             << "[--radroot RADIUS]        Radius of root sphere (optional)\n"
             << "[--explrad RADIUS]        Default exploration radius if not \n"
             << "                          provided in the input file\n"
+            << "[--quantum FACTOR]        Archive (.aggz) quantization step relative\n"
+            << "                          to the precision (default : 0.01)\n"
+            << "[--morton]                Store archive spheres in Morton order\n"
+            << "[--lod CELL]              Merge the spheres of each cell of side CELL\n"
+            << "                          in .ply and .vtk outputs (default : 0, none)\n"
+            << "[--cca BOX]               Cluster-cluster aggregation of the spawn file\n"
+            << "                          spheres in a periodic box of side BOX\n"
+            << "[--sticking PROBABILITY]  Sticking probability of clusters (default : 1)\n"
+            << "[--dla]                   Diffusion limited (Brownian) trajectories\n"
+            << "[--candidates SET]        Local minimization candidates, random or\n"
+            << "                          fibonacci (default : random)\n"
+            << "[--layers N]              Layers of the local minimization (default : 30)\n"
+            << "[--points N]              Candidates per layer (default : 50)\n"
+            << "[--patience K]            Stop the local minimization after K layers\n"
+            << "                          without improvement (default : never)\n"
+            << "[--shrink FACTOR]         Step factor after a layer without improvement\n"
+            << "                          (default : 1)\n"
+            << "[--budget N]              Maximum candidates per sphere (default : none)\n"
+            << "[--minimizer NAME]        Local minimization, stochastic or rolling\n"
+            << "                          (default : stochastic)\n"
+            << "[--seed N]                Seed of the random numbers (default : random,\n"
+            << "                          0 for an ensemble)\n"
+            << "[--ensemble N]            Grow N aggregates in a .aggz archive\n"
+            << "[--shard i/N]             Grow only the ensemble members i, i + N...\n"
+            << "[--progress SECONDS]      Report the progress and ETA on stderr every\n"
+            << "                          SECONDS\n"
+            << "[--status FILE]           Write the progress as JSON in FILE, every 10 s\n"
+            << "                          or at the --progress interval\n"
+            << "[--reorder K]             Sort the spheres along a Morton curve and\n"
+            << "                          rebuild the octree every K spawns (default : 0,\n"
+            << "                          never)\n"
+            << "[--analyze VOXEL]         Voxelize the aggregate with voxels of side\n"
+            << "                          VOXEL, and write its porosity, surface and\n"
+            << "                          density profile in OUTPUT.analysis\n"
+            << "[--mem-limit MB]          Keep the resident spheres and their octree\n"
+            << "                          within MB megabytes, the buried spheres being\n"
+            << "                          spilled to a temporary file, text output only\n"
+            << "                          (default : none)\n"
+            << "\n"
+            << "aggregate merge OUTPUT INPUT...  Merge the archives of the shards\n"
             << '\n';
         return 0;
     }
@@ -98,64 +290,248 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    Agg::Control::Controller controller({{0.0, 0.0, 0.0}, rad_root}, 500.0);
-
-    if (file_input_provided)
+    const auto output_ext = [&file_output](const std::string &ext) {
+        return file_output.size() >= ext.size() &&
+               file_output.compare(file_output.size() - ext.size(), ext.size(), ext) == 0;
+    };
+    const auto archive_output = output_ext(".aggz");
+    const auto ensemble_mode = ensemble > 1 || shard.count > 1;
+    if (ensemble_mode && !archive_output)
     {
-        Agg::File::input(controller, file_input);
+        std::cerr << "An ensemble is written in an archive, use a .aggz output" << std::endl;
+        return -1;
+    }
+    if (cca_mode && file_input_provided)
+    {
+        std::cerr << "--input cannot be combined with --cca, the clusters start from the spawn file" << std::endl;
+        return -1;
+    }
+    if (mem_limit > 0.0 && (reorder != 0 || cca_mode || analysis_voxel > 0.0 || ensemble_mode))
+    {
+        std::cerr << "--mem-limit cannot be combined with --reorder, --cca, --analyze or an ensemble" << std::endl;
+        return -1;
+    }
+    if (mem_limit > 0.0 && (archive_output || output_ext(".ply") || output_ext(".vtk")))
+    {
+        std::cerr << "--mem-limit streams a text output, the spilled spheres never come back in memory"
+                  << std::endl;
+        return -1;
     }
 
-    const auto spheres_input = Agg::File::read(file_spawn);
-
-    time_t clkBegin;
-    if (do_time)
-        clkBegin = clock();
-
-    auto spawn_policy = [&controller, &angle_provided, &alpha, &beta](double rad) {
-        using Sphere = Agg::Object::Sphere<double>;
+    auto write_output = [&](const Agg::Aggregate<Agg::Object::Sphere<double>> &agg, double precision) {
+        if (archive_output)
+        {
+            archive_options.quantum = quantum * precision;
+            Agg::File::writeArchive(agg, file_output, archive_options);
+        }
+        else if (output_ext(".ply"))
+        {
+            Agg::File::writePly(agg, file_output, lod);
+        }
+        else if (output_ext(".vtk"))
+        {
+            Agg::File::writeVtk(agg, file_output, lod);
+        }
+        else
+        {
+            Agg::File::write(agg, file_output);
+        }
+    };
 
-        auto begin = controller.agg.objects.cbegin();
-        auto end = controller.agg.objects.cend();
-        const auto max_rad = std::max_element(begin, end,
-                                              [](const Sphere &lhs, const Sphere &rhs) { return lhs.coord.Length() < rhs.coord.Length(); });
+    const auto spheres_input = Agg::File::read(file_spawn);
+    if (!spheres_input.has_value())
+        return -1;
 
-        const auto new_radius = max_rad->coord.Length() + rad + controller.agg.root.radius + 2 * controller.dt;
-        if (angle_provided)
+    // The moves of the clusters are the smallest spawn radius by default, it is their precision
+    if (cca_mode && !(cca_params.step > 0.0) && !spheres_input->empty())
+    {
+        cca_params.step = std::numeric_limits<double>::infinity();
+        for (const auto &s : *spheres_input)
         {
-            return Math::rand_point_sphere_angle({0.0, 0.0, 0.0}, new_radius, alpha, beta);
+            cca_params.step = std::min(cca_params.step, std::get<1>(s));
         }
-        return Math::rand_point_sphere({0.0, 0.0, 0.0}, new_radius);
-    };
+    }
+
+    auto any_controller = Agg::Control::makeController(
+        dla_mode ? Agg::Control::Trajectory::Brownian : Agg::Control::Trajectory::Ballistic, minimizer,
+        angle_provided ? std::optional<Agg::Control::Policy::AngleSpawn>{{alpha, beta}} : std::nullopt,
+        {{0.0, 0.0, 0.0}, rad_root}, 500.0);
+    const auto configured = std::visit(
+        [&](auto &controller) {
+            controller.candidates = candidates;
+            controller.setSearch(search);
+            controller.reorderEvery = reorder;
+            return controller.setMemoryLimit(static_cast<std::size_t>(mem_limit * (1 << 20)));
+        },
+        any_controller);
+    if (configured != 0)
+        return -1;
 
-    for (const auto &s : spheres_input)
+    // Progress over all the spheres of the recipe, for each member grown here
+    std::uint64_t recipe_spheres = 0;
+    for (const auto &s : *spheres_input)
     {
-        for (unsigned int j = 0; j < std::get<0>(s); j++)
+        recipe_spheres += std::get<0>(s);
+    }
+    const auto nb_members = ensemble_mode ? Agg::Ensemble::members(ensemble, shard).size() : 1;
+    Agg::Progress::Reporter reporter{recipe_spheres * nb_members, progress_interval, progress_provided, file_status};
+    const auto reporting = reporter.enabled() && !cca_mode;
+
+    // Grow one aggregate and hand it to done, returns 0 on success
+    auto grow = [&](const auto &done) {
+        const auto clkBegin = clock();
+
+        if (cca_mode)
         {
-            const auto curr_radius = std::get<1>(s);
-            if (curr_radius > rad_root)
+            Agg::Cluster::Engine engine{cca_params};
+            for (const auto &s : *spheres_input)
             {
-                std::cerr << "An input sphere cannot have a higher radius than the root sphere : " << rad_root << '\n';
-                return -1;
+                for (unsigned int j = 0; j < std::get<0>(s); j++)
+                {
+                    if (!engine.addMonomer(std::get<1>(s)))
+                    {
+                        std::cerr << "No room left for the spheres in a box of side " << cca_params.box << '\n';
+                        return -1;
+                    }
+                }
             }
-            else if (std::get<2>(s) == 0.0)
-            {
-                controller.spawn(spawn_policy(curr_radius), curr_radius, default_expl_rad);
-            }
-            else
+            engine.run();
+            if (engine.spans())
+                std::cerr << "A cluster spans half the box, the aggregation stopped with " << engine.size()
+                          << " clusters" << std::endl;
+
+            if (do_time)
             {
-                controller.spawn(spawn_policy(curr_radius), curr_radius, std::get<2>(s));
+                std::cout << "Time: " << double(clock() - clkBegin) / CLOCKS_PER_SEC << std::endl;
             }
+            done(engine.largest(), engine.getStep());
+            return 0;
         }
+
+        return std::visit(
+            [&](auto &controller) {
+                controller.reset();
+                if (file_input_provided)
+                {
+                    if (Agg::File::input(controller, file_input) != 0)
+                        return -1;
+                }
+                reporter.start();
+
+                for (const auto &s : *spheres_input)
+                {
+                    for (unsigned int j = 0; j < std::get<0>(s); j++)
+                    {
+                        const auto curr_radius = std::get<1>(s);
+                        if (std::get<2>(s) == 0.0)
+                        {
+                            controller.spawn(curr_radius, default_expl_rad);
+                        }
+                        else
+                        {
+                            controller.spawn(curr_radius, std::get<2>(s));
+                        }
+                        if (reporting)
+                            reporter.tick(controller);
+                    }
+                }
+
+                if (do_time)
+                {
+                    time_t clkEnd = clock();
+                    double elapsed_secs = double(clkEnd - clkBegin) / CLOCKS_PER_SEC;
+                    std::cout << "Time: " << elapsed_secs << std::endl;
+
+                    const auto &counters = controller.getCounters();
+                    const auto per_sphere = [&counters](std::uint64_t count) {
+                        return counters.spheres == 0 ? 0.0 : double(count) / counters.spheres;
+                    };
+                    std::cout << "Candidates: " << counters.candidates << " (" << per_sphere(counters.candidates)
+                              << " per sphere), collision tests: " << counters.collisions << " ("
+                              << per_sphere(counters.collisions) << " per sphere)";
+                    if (counters.rolls > 0)
+                        std::cout << ", rolling steps: " << counters.rolls;
+                    std::cout << ", octree lookups: " << counters.lookups;
+                    std::cout << std::endl;
+
+                    if (const auto *spill = controller.getSpill())
+                        std::cout << "Out of core: " << spill->size() << " spheres spilled in "
+                                  << spill->fileBytes() / double(1 << 20) << " MB, " << spill->reads()
+                                  << " blocks read back, resident part of "
+                                  << controller.residentBytes() / double(1 << 20) << " MB" << std::endl;
+                }
+
+                if (const auto *spill = controller.getSpill())
+                    return Agg::File::write(controller.agg, *spill, file_output);
+                done(controller.agg, controller.dt);
+                return 0;
+            },
+            any_controller);
+    };
+
+    std::vector<Agg::Analysis::Result> analyses{};
+    const auto analyze = [&](const Agg::Aggregate<Agg::Object::Sphere<double>> &agg, std::uint64_t id) {
+        Agg::Analysis::Result result{};
+        result.id = id;
+        if (Agg::Analysis::analyze(agg.objects, analysis_voxel, result) != 0)
+            return EXIT_FAILURE;
+        analyses.push_back(std::move(result));
+        return 0;
+    };
+
+    if (!ensemble_mode)
+    {
+        if (seed_provided)
+            Math::seed(seed);
+        auto analyzed = true;
+        const auto status = grow([&](const Agg::Aggregate<Agg::Object::Sphere<double>> &agg, double precision) {
+            write_output(agg, precision);
+            analyzed = analysis_voxel == 0.0 || analyze(agg, 0) == 0;
+        });
+        if (status != 0 || analysis_voxel == 0.0)
+            return status;
+        if (!analyzed || Agg::Analysis::writeAnalysis(Agg::Analysis::analysisFile(file_output), analyses) != 0)
+            return -1;
+        std::cout << Agg::Analysis::format(analyses.front()) << std::endl;
+        return 0;
+    }
+
+    // Each member has its own seed, a member is the same whatever the shard growing it
+    const auto dt = std::visit([](const auto &controller) { return controller.dt; }, any_controller);
+    archive_options.quantum = quantum * (cca_mode ? cca_params.step : dt);
+    Agg::File::ArchiveWriter archive{file_output, archive_options};
+    if (!archive.is_open())
+    {
+        std::cerr << "Cannot write the ensemble in " << file_output << std::endl;
+        return -1;
     }
 
-    if (do_time)
+    std::vector<Agg::Ensemble::MemberStats> stats{};
+    for (const auto id : Agg::Ensemble::members(ensemble, shard))
     {
-        time_t clkEnd = clock();
-        double elapsed_secs = double(clkEnd - clkBegin) / CLOCKS_PER_SEC;
-        std::cout << "Time: " << elapsed_secs << std::endl;
+        const auto member_seed = Agg::Ensemble::memberSeed(seed, id);
+        Math::seed(member_seed);
+        auto analyzed = true;
+        const auto status = grow([&](const Agg::Aggregate<Agg::Object::Sphere<double>> &agg, double) {
+            archive.add(id, agg.objects);
+            stats.push_back(Agg::Ensemble::statistics(agg, id, member_seed));
+            analyzed = analysis_voxel == 0.0 || analyze(agg, id) == 0;
+        });
+        if (status != 0)
+            return status;
+        if (!analyzed)
+            return -1;
     }
 
-    Agg::File::write(controller.agg, file_output);
+    if (archive.close() != 0 || Agg::Ensemble::writeStats(Agg::Ensemble::statsFile(file_output), stats) != 0)
+    {
+        std::cerr << "Cannot write the ensemble in " << file_output << std::endl;
+        return -1;
+    }
+    if (analysis_voxel > 0.0 && Agg::Analysis::writeAnalysis(Agg::Analysis::analysisFile(file_output), analyses) != 0)
+        return -1;
+    Agg::Ensemble::summary(stats);
+    std::cout << "Ensemble written in : " << file_output << std::endl;
 
     return 0;
 }
\ No newline at end of file
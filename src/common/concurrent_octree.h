@@ -0,0 +1,364 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <vector>
+
+#include "vector_math.h"
+
+// Octree filled by many threads at once, with the queries of Octree. Insertions never lock: an
+// element claims a slot of a cube page with an atomic increment and is published by the flag of
+// its slot, children and extra pages are published by a compare and swap. The queries are wait
+// free and see the elements published before they reach their cube. Elements are never moved nor
+// removed, clear is the only operation that must not run concurrently.
+//
+// T has coord and radius members, and a touches(elem, coord, radius) overload found by argument
+// dependent lookup for the intersection queries
+template <typename T, typename V = double>
+class ConcurrentOctree
+{
+  public:
+    ConcurrentOctree(const Math::Vec3<V> &coord, const V &depth, int degree = 8)
+        : capacity(static_cast<std::uint32_t>(std::max(1, degree)))
+    {
+        root.init({coord, depth}, capacity);
+    }
+
+    ConcurrentOctree(const ConcurrentOctree &) = delete;
+    ConcurrentOctree &operator=(const ConcurrentOctree &) = delete;
+
+    // Thread safe, false if elem lies outside the tree
+    bool insert(const T &elem)
+    {
+        if (!root.boundary.contains(elem.coord))
+            return false;
+
+        auto *node = &root;
+        for (int level = 0;; ++level)
+        {
+            // The cubes on the way cover the element before it is visible
+            node->raiseReach(elem.radius);
+            if (node->first.append(elem, capacity))
+                break;
+
+            // Elements too large for the children, or missed by the rounded children on the
+            // boundary, go to the extra pages of this cube
+            auto *child = level < maxLevel && elem.radius <= node->boundary.depth * .5 ? node->child(elem.coord, capacity)
+                                                                                       : nullptr;
+            if (child == nullptr || !child->boundary.contains(elem.coord))
+            {
+                node->first.appendExtra(elem, capacity);
+                break;
+            }
+            node = child;
+        }
+
+        count.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    // Elements published so far
+    std::size_t size() const
+    {
+        return count.load(std::memory_order_acquire);
+    }
+
+    // Not thread safe: remove every element
+    void clear()
+    {
+        const auto boundary = root.boundary;
+        root.destroy();
+        root.init(boundary, capacity);
+        count.store(0, std::memory_order_release);
+    }
+
+    // Elements whose center lies in the cube (coord, depth)
+    void getNeighbors(const Math::Vec3<V> &coord, const V &depth, std::vector<T> &found) const
+    {
+        root.neighbors(Cube{coord, depth}, found);
+    }
+
+    // Elements whose sphere intersects the sphere (coord, radius)
+    void getIntersecting(const Math::Vec3<V> &coord, const V &radius, std::vector<T> &found) const
+    {
+        root.intersecting(coord, radius, found);
+    }
+
+    // Element whose surface is the closest to coord, if closer than maxDist
+    std::optional<T> nearest(const Math::Vec3<V> &coord, V maxDist) const
+    {
+        const T *result = nullptr;
+        root.nearest(coord, maxDist, result);
+        if (result == nullptr)
+            return std::nullopt;
+        return *result;
+    }
+
+  private:
+    struct Cube
+    {
+        Math::Vec3<V> coord{};
+        V depth{};
+
+        bool contains(const Math::Vec3<V> &p_coord) const
+        {
+            const Math::Vec3<V> depth_v{depth, depth, depth};
+            return (p_coord >= coord - depth_v) && (p_coord <= coord + depth_v);
+        }
+
+        // Squared euclidean distance from a point to the cube, 0 inside
+        V distance2(const Math::Vec3<V> &p_coord) const
+        {
+            const auto dx = std::max(std::abs(p_coord.x - coord.x) - depth, V{0});
+            const auto dy = std::max(std::abs(p_coord.y - coord.y) - depth, V{0});
+            const auto dz = std::max(std::abs(p_coord.z - coord.z) - depth, V{0});
+            return dx * dx + dy * dy + dz * dz;
+        }
+
+        bool intersects(const Cube &other) const
+        {
+            const auto reach = depth + other.depth;
+            return std::abs(coord.x - other.coord.x) <= reach && std::abs(coord.y - other.coord.y) <= reach &&
+                   std::abs(coord.z - other.coord.z) <= reach;
+        }
+    };
+
+    // An element is readable once its flag is set
+    struct Slot
+    {
+        std::atomic<bool> ready{false};
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        const T &elem() const
+        {
+            return *std::launder(reinterpret_cast<const T *>(storage));
+        }
+    };
+
+    // Fixed number of slots, the pages of a cube are chained
+    struct Page
+    {
+        std::unique_ptr<Slot[]> slots{};
+        std::atomic<std::uint32_t> reserved{0};
+        std::atomic<Page *> next{nullptr};
+
+        bool append(const T &elem, std::uint32_t capacity)
+        {
+            // Full pages are not incremented further
+            if (reserved.load(std::memory_order_relaxed) >= capacity)
+                return false;
+            const auto i = reserved.fetch_add(1, std::memory_order_relaxed);
+            if (i >= capacity)
+                return false;
+
+            new (slots[i].storage) T(elem);
+            slots[i].ready.store(true, std::memory_order_release);
+            return true;
+        }
+
+        void appendExtra(const T &elem, std::uint32_t capacity)
+        {
+            for (auto *page = this;; page = page->following(capacity))
+            {
+                if (page->append(elem, capacity))
+                    return;
+            }
+        }
+
+        Page *following(std::uint32_t capacity)
+        {
+            auto *current = next.load(std::memory_order_acquire);
+            if (current != nullptr)
+                return current;
+
+            auto *fresh = new Page{};
+            fresh->slots = std::make_unique<Slot[]>(capacity);
+            if (next.compare_exchange_strong(current, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+                return fresh;
+            delete fresh; // Another thread published its page first
+            return current;
+        }
+
+        template <typename F>
+        void forEach(std::uint32_t capacity, F &&f) const
+        {
+            for (const auto *page = this; page != nullptr; page = page->next.load(std::memory_order_acquire))
+            {
+                const auto used = std::min(page->reserved.load(std::memory_order_acquire), capacity);
+                for (std::uint32_t i = 0; i < used; ++i)
+                {
+                    // Slots claimed by an insertion still in progress are skipped
+                    if (page->slots[i].ready.load(std::memory_order_acquire))
+                        f(page->slots[i].elem());
+                }
+            }
+        }
+
+        void destroy(std::uint32_t capacity)
+        {
+            for (std::uint32_t i = 0; i < capacity; ++i)
+            {
+                if (slots[i].ready.load(std::memory_order_relaxed))
+                    slots[i].elem().~T();
+            }
+            auto *page = next.exchange(nullptr, std::memory_order_relaxed);
+            while (page != nullptr)
+            {
+                auto *following = page->next.load(std::memory_order_relaxed);
+                page->next.store(nullptr, std::memory_order_relaxed);
+                page->destroy(capacity);
+                delete page;
+                page = following;
+            }
+        }
+    };
+
+    struct Node
+    {
+        Cube boundary{};
+        std::uint32_t capacity = 0;
+        std::atomic<V> reach{};
+        Page first{};
+        std::atomic<Node *> children{nullptr}; // Eight nodes, allocated together
+
+        void init(const Cube &cube, std::uint32_t capacity_)
+        {
+            boundary = cube;
+            capacity = capacity_;
+            reach.store(V{}, std::memory_order_relaxed);
+            first.slots = std::make_unique<Slot[]>(capacity);
+            first.reserved.store(0, std::memory_order_relaxed);
+        }
+
+        void destroy()
+        {
+            if (first.slots == nullptr)
+                return;
+            first.destroy(capacity);
+            first.slots.reset();
+            delete[] children.exchange(nullptr, std::memory_order_relaxed);
+        }
+
+        ~Node()
+        {
+            destroy();
+        }
+
+        void raiseReach(V radius)
+        {
+            auto current = reach.load(std::memory_order_relaxed);
+            while (current < radius &&
+                   !reach.compare_exchange_weak(current, radius, std::memory_order_release, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        // Child holding coord, the eight children are created on first use
+        Node *child(const Math::Vec3<V> &coord, std::uint32_t degree)
+        {
+            auto *current = children.load(std::memory_order_acquire);
+            if (current == nullptr)
+            {
+                auto *fresh = new Node[8];
+                const auto half = boundary.depth * .5;
+                for (int i = 0; i < 8; ++i)
+                {
+                    const Math::Vec3<V> origin{boundary.coord.x + (i & 4 ? half : -half),
+                                               boundary.coord.y + (i & 2 ? half : -half),
+                                               boundary.coord.z + (i & 1 ? half : -half)};
+                    fresh[i].init({origin, half}, degree);
+                }
+                if (children.compare_exchange_strong(current, fresh, std::memory_order_acq_rel,
+                                                     std::memory_order_acquire))
+                    current = fresh;
+                else
+                    delete[] fresh; // Another thread published its children first
+            }
+            return &current[octant(coord)];
+        }
+
+        int octant(const Math::Vec3<V> &coord) const
+        {
+            return (coord.x > boundary.coord.x ? 4 : 0) | (coord.y > boundary.coord.y ? 2 : 0) |
+                   (coord.z > boundary.coord.z ? 1 : 0);
+        }
+
+        void neighbors(const Cube &range, std::vector<T> &found) const
+        {
+            if (!boundary.intersects(range))
+                return;
+
+            first.forEach(capacity, [&](const T &elem) {
+                if (range.contains(elem.coord))
+                    found.push_back(elem);
+            });
+
+            if (const auto *nodes = children.load(std::memory_order_acquire))
+            {
+                for (int i = 0; i < 8; ++i)
+                {
+                    nodes[i].neighbors(range, found);
+                }
+            }
+        }
+
+        void intersecting(const Math::Vec3<V> &coord, const V &radius, std::vector<T> &found) const
+        {
+            const auto range = radius + reach.load(std::memory_order_acquire);
+            if (boundary.distance2(coord) > range * range)
+                return;
+
+            first.forEach(capacity, [&](const T &elem) {
+                if (touches(elem, coord, radius))
+                    found.push_back(elem);
+            });
+
+            if (const auto *nodes = children.load(std::memory_order_acquire))
+            {
+                for (int i = 0; i < 8; ++i)
+                {
+                    nodes[i].intersecting(coord, radius, found);
+                }
+            }
+        }
+
+        void nearest(const Math::Vec3<V> &coord, V &best, const T *&result) const
+        {
+            if (std::sqrt(boundary.distance2(coord)) - reach.load(std::memory_order_acquire) >= best)
+                return;
+
+            first.forEach(capacity, [&](const T &elem) {
+                const auto dist = Math::Distance(elem.coord, coord) - elem.radius;
+                if (dist < best)
+                {
+                    best = dist;
+                    result = &elem;
+                }
+            });
+
+            if (const auto *nodes = children.load(std::memory_order_acquire))
+            {
+                // Start with the child holding coord, it gives the tightest bound
+                const auto closest = octant(coord);
+                nodes[closest].nearest(coord, best, result);
+                for (int i = 0; i < 8; ++i)
+                {
+                    if (i != closest)
+                        nodes[i].nearest(coord, best, result);
+                }
+            }
+        }
+    };
+
+    // Cubes below are too small for the double precision of the coordinates
+    static constexpr int maxLevel = 40;
+
+    std::uint32_t capacity;
+    Node root{};
+    std::atomic<std::size_t> count{0};
+};
\ No newline at end of file
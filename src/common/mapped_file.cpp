@@ -0,0 +1,96 @@
+#include <fstream>
+#include <utility>
+
+#include "mapped_file.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_MMAP 1
+#endif
+
+MappedFile::MappedFile(const std::string &fileName)
+{
+#ifdef MAPPED_FILE_MMAP
+    const int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0)
+    {
+        opened = true;
+        length = static_cast<std::size_t>(st.st_size);
+        if (length > 0)
+        {
+            void *addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                opened = false;
+                length = 0;
+            }
+            else
+            {
+                ::madvise(addr, length, MADV_SEQUENTIAL);
+                data = static_cast<const char *>(addr);
+                mapped = true;
+            }
+        }
+    }
+    ::close(fd);
+#else
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return;
+
+    opened = true;
+    length = static_cast<std::size_t>(file.tellg());
+    if (length > 0)
+    {
+        auto buffer = new char[length];
+        file.seekg(0);
+        file.read(buffer, static_cast<std::streamsize>(length));
+        data = buffer;
+    }
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : data(std::exchange(other.data, nullptr)), length(std::exchange(other.length, 0)),
+      opened(std::exchange(other.opened, false)), mapped(std::exchange(other.mapped, false))
+{
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        data = std::exchange(other.data, nullptr);
+        length = std::exchange(other.length, 0);
+        opened = std::exchange(other.opened, false);
+        mapped = std::exchange(other.mapped, false);
+    }
+    return *this;
+}
+
+void MappedFile::close()
+{
+#ifdef MAPPED_FILE_MMAP
+    if (mapped)
+        ::munmap(const_cast<char *>(data), length);
+#else
+    delete[] data;
+#endif
+    data = nullptr;
+    length = 0;
+    opened = false;
+    mapped = false;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only view of a whole file, memory mapped when the platform allows it
+class MappedFile
+{
+  public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string &fileName);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    bool is_open() const
+    {
+        return opened;
+    }
+
+    std::string_view view() const
+    {
+        return {data, length};
+    }
+
+  private:
+    void close();
+
+  private:
+    const char *data = nullptr;
+    std::size_t length = 0;
+    bool opened = false;
+    bool mapped = false;
+};
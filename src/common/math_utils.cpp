@@ -7,28 +7,227 @@
 namespace Math
 {
 
+namespace
+{
+
+inline std::uint64_t rotl(std::uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// xoshiro256+ on four independent lanes, stored lane by lane so that one step of the four lanes
+// compiles to vector instructions
+class Lanes
+{
+  public:
+    static constexpr int count = 4;
+
+    void seed(std::uint64_t value)
+    {
+        for (int l = 0; l < count; ++l)
+        {
+            for (int k = 0; k < 4; ++k)
+            {
+                value = splitmix64(value);
+                s[k][l] = value;
+            }
+        }
+    }
+
+    // n outputs, a multiple of count
+    void fill(std::uint64_t *out, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; i += count)
+        {
+            for (int l = 0; l < count; ++l)
+            {
+                out[i + l] = s[0][l] + s[3][l];
+                const auto t = s[1][l] << 17;
+                s[2][l] ^= s[0][l];
+                s[3][l] ^= s[1][l];
+                s[1][l] ^= s[2][l];
+                s[0][l] ^= s[3][l];
+                s[2][l] ^= t;
+                s[3][l] = rotl(s[3][l], 45);
+            }
+        }
+    }
+
+  private:
+    std::uint64_t s[4][count]{};
+};
+
+// Unit vectors drawn a block ahead of their use. Marsaglia's method: (a, b) uniform in the unit
+// disk gives (2a sqrt(1 - s), 2b sqrt(1 - s), 1 - 2s) with s = a² + b², uniform on the sphere.
+// The candidates are computed without branch and the rejected ones dropped afterwards.
+class UnitVectors
+{
+  public:
+    void seed(std::uint64_t value)
+    {
+        lanes.seed(value);
+        next = size; // The buffered vectors belong to the previous seed
+    }
+
+    Vec3<double> draw()
+    {
+        if (next == size)
+            refill();
+        const Vec3<double> v{x[next], y[next], z[next]};
+        ++next;
+        return v;
+    }
+
+  private:
+    static constexpr std::size_t size = 1024;
+    static constexpr std::size_t batch = 256; // Candidates per pass, about 79% accepted
+
+    void refill()
+    {
+        std::size_t filled = 0;
+        while (filled < size)
+        {
+            lanes.fill(bits, 2 * batch);
+            for (std::size_t i = 0; i < batch; ++i)
+            {
+                // The 53 high bits give a uniform double in [-1, 1)
+                const auto a = static_cast<double>(bits[2 * i] >> 11) * 0x1.0p-52 - 1;
+                const auto b = static_cast<double>(bits[2 * i + 1] >> 11) * 0x1.0p-52 - 1;
+                const auto s = a * a + b * b;
+                const auto t = 2 * std::sqrt(std::max(1 - s, 0.0));
+                cx[i] = a * t;
+                cy[i] = b * t;
+                cz[i] = 1 - 2 * s;
+                accepted[i] = s < 1 && s > 0;
+            }
+            for (std::size_t i = 0; i < batch && filled < size; ++i)
+            {
+                x[filled] = cx[i];
+                y[filled] = cy[i];
+                z[filled] = cz[i];
+                filled += accepted[i];
+            }
+        }
+        next = 0;
+    }
+
+    Lanes lanes{};
+    double x[size], y[size], z[size];
+    std::size_t next = size;
+    std::uint64_t bits[2 * batch];
+    double cx[batch], cy[batch], cz[batch];
+    bool accepted[batch];
+};
+
+// Same four lanes for the scalar draws, one lane at a time
+class Generator
+{
+  public:
+    using result_type = std::uint64_t;
+
+    static constexpr result_type min()
+    {
+        return 0;
+    }
+    static constexpr result_type max()
+    {
+        return ~result_type{0};
+    }
+
+    void seed(std::uint64_t value)
+    {
+        lanes.seed(value);
+        next = size;
+    }
+
+    result_type operator()()
+    {
+        if (next == size)
+        {
+            lanes.fill(block, size);
+            next = 0;
+        }
+        return block[next++];
+    }
+
+  private:
+    static constexpr std::size_t size = 256;
+
+    Lanes lanes{};
+    std::uint64_t block[size];
+    std::size_t next = size;
+};
+
+} // namespace
+
 static std::random_device rd;
-static std::default_random_engine generator(rd());
+static Generator generator{};
+static UnitVectors unit_vectors{};
 static std::normal_distribution<double> normal_dist(0, 1);
+static std::uniform_real_distribution<double> uniform_dist(0, 1);
+
+void seed(std::uint64_t value)
+{
+    generator.seed(value);
+    unit_vectors.seed(splitmix64(value));
+    normal_dist.reset();
+    uniform_dist.reset();
+}
+
+// Random seed until a seed is given
+static const bool seeded = (seed((std::uint64_t{rd()} << 32) | rd()), true);
+
+double rand_uniform()
+{
+    return uniform_dist(generator);
+}
+
+Rotation rand_rotation()
+{
+    // Random unit quaternion (Shoemake)
+    const auto u1 = uniform_dist(generator), u2 = uniform_dist(generator), u3 = uniform_dist(generator);
+    const auto a = std::sqrt(1 - u1), b = std::sqrt(u1);
+    const auto x = a * std::sin(2 * M_PI * u2), y = a * std::cos(2 * M_PI * u2);
+    const auto z = b * std::sin(2 * M_PI * u3), w = b * std::cos(2 * M_PI * u3);
+
+    return {Vec3<double>{1 - 2 * (y * y + z * z), 2 * (x * y - z * w), 2 * (x * z + y * w)},
+            Vec3<double>{2 * (x * y + z * w), 1 - 2 * (x * x + z * z), 2 * (y * z - x * w)},
+            Vec3<double>{2 * (x * z - y * w), 2 * (y * z + x * w), 1 - 2 * (x * x + y * y)}};
+}
+
+std::vector<Vec3<double>> fibonacci_sphere(std::size_t n)
+{
+    const auto golden_angle = M_PI * (3 - std::sqrt(5.0));
+
+    std::vector<Vec3<double>> points{};
+    points.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const auto z = 1 - (2 * i + 1) / static_cast<double>(n);
+        const auto r = std::sqrt(1 - z * z);
+        const auto phi = golden_angle * i;
+        points.emplace_back(r * std::cos(phi), r * std::sin(phi), z);
+    }
+    return points;
+}
+
+Vec3<double> rand_unit_vector()
+{
+    return unit_vectors.draw();
+}
 
 template <>
 Vec3<double> rand_point_sphere(const Vec3<double> &from, const double &rad)
 {
-    const Vec3<double> x{normal_dist(generator), normal_dist(generator), normal_dist(generator)};
-    const Vec3<double> ratio{1 / x.Length(), 1 / x.Length(), 1 / x.Length()};
-    const Vec3<double> radius{rad, rad, rad};
-
-    return from + x * ratio * radius;
+    return from + unit_vectors.draw() * rad;
 }
 
 template <>
 Vec3<double> rand_point_sphere_angle(const Vec3<double> &from, const double &rad, double alpha, double beta)
 {
-    std::normal_distribution<double> normal_dist_alpha(0, alpha);
-    std::normal_distribution<double> normal_dist_beta(-90.0, beta);
-
-    const auto rand_alpha = normal_dist_alpha(generator) * M_PI / 180.0;
-    const auto rand_beta = normal_dist_beta(generator) * M_PI / 180.0;
+    // Normal angles of deviations alpha and beta around 0 and -90 degrees
+    const auto rand_alpha = normal_dist(generator) * alpha * M_PI / 180.0;
+    const auto rand_beta = (normal_dist(generator) * beta - 90.0) * M_PI / 180.0;
 
     const auto x = rad * std::cos(rand_alpha) * std::cos(rand_beta);
     const auto y = rad * std::sin(rand_alpha) * std::cos(rand_beta);
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <random>
+#include <vector>
 
 #include "vector_math.h"
 
@@ -16,6 +19,57 @@ inline constexpr Vec3<T> sign(const Vec3<T> &x)
         static_cast<T>((0 < x[2]) - (x[2] < 0))};
 }
 
+// Spread the 21 lower bits of x, two zero bits between each of them
+inline constexpr std::uint64_t morton_spread(std::uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+// Morton code (Z-order) of a point on a 2^21 grid
+inline constexpr std::uint64_t morton3(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+    return morton_spread(x) << 2 | morton_spread(y) << 1 | morton_spread(z);
+}
+
+// SplitMix64 mix of x, close seeds give unrelated results
+inline constexpr std::uint64_t splitmix64(std::uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+// Restart the random numbers from a seed, the same seed gives the same sequence
+void seed(std::uint64_t value);
+
+// Uniform real number in [0, 1)
+double rand_uniform();
+
+// Rotation matrix as its three rows
+using Rotation = std::array<Vec3<double>, 3>;
+
+inline constexpr Vec3<double> rotate(const Rotation &m, const Vec3<double> &v)
+{
+    return {m[0].x * v.x + m[0].y * v.y + m[0].z * v.z, m[1].x * v.x + m[1].y * v.y + m[1].z * v.z,
+            m[2].x * v.x + m[2].y * v.y + m[2].z * v.z};
+}
+
+// Uniformly distributed random rotation
+Rotation rand_rotation();
+
+// n unit vectors evenly spread over the sphere along a Fibonacci spiral
+std::vector<Vec3<double>> fibonacci_sphere(std::size_t n);
+
+// Uniformly distributed unit vector, drawn from a block computed ahead
+Vec3<double> rand_unit_vector();
+
 template <typename T>
 Vec3<T> rand_point_sphere(const Vec3<T> &from, const T &rad);
 
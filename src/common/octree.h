@@ -1,18 +1,28 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 #include <memory>
+#include <memory_resource>
+#include <optional>
 #include <iostream>
 
 #include "vector_math.h"
 
+// T has coord and radius members, and a touches(elem, coord, radius) overload found by argument
+// dependent lookup for the intersection queries
 template <typename T, typename V = double>
 class Octree
 {
   public:
-    Octree(const Math::Vec3<V> &coord, const V &depth, int degree = 4) : boundary({coord, depth}),
-                                                                         capacity(degree),
-                                                                         divided(false){};
+    // Nodes and element lists are allocated from resource, an arena makes them cheap to build and drop
+    Octree(const Math::Vec3<V> &coord, const V &depth, int degree = 4,
+           std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : boundary({coord, depth}), capacity(degree), lstObjects(resource), children(resource), divided(false)
+    {
+        lstObjects.reserve(capacity + 1);
+    };
 
   public:
     bool insert(const T &elem)
@@ -20,12 +30,23 @@ class Octree
         if (!boundary.contains(elem.coord))
             return false;
 
+        reach = std::max(reach, elem.radius);
+        ++count;
+
         if (lstObjects.size() <= capacity)
         {
             lstObjects.push_back(elem);
             return true;
         }
 
+        // Elements too large for the children stay at this level, so that the spheres held by a
+        // cube never stick out of it by more than its half size
+        if (elem.radius > boundary.depth * .5)
+        {
+            lstObjects.push_back(elem);
+            return true;
+        }
+
         if (!divided)
             subdivide();
 
@@ -37,7 +58,80 @@ class Octree
             }
         }
 
-        return false;
+        // On the boundary the rounded children may all miss an element this cube contains
+        lstObjects.push_back(elem);
+        return true;
+    }
+
+    // Remove an element equal to elem, cubes left with few enough elements absorb their children.
+    // The dropped children and grown lists are deallocated, which an arena such as a monotonic
+    // buffer ignores: a tree removing often belongs on a resource that reuses memory
+    bool remove(const T &elem)
+    {
+        if (!boundary.contains(elem.coord))
+            return false;
+
+        const auto it = std::find_if(lstObjects.begin(), lstObjects.end(),
+                                     [&elem](const T &other) { return same(elem, other); });
+        if (it != lstObjects.end())
+        {
+            *it = lstObjects.back();
+            lstObjects.pop_back();
+        }
+        else
+        {
+            // Elements on a cube face may be held by any of the children sharing it
+            bool removed = false;
+            for (int i = 0; i < 8 && divided && !removed; ++i)
+            {
+                removed = children[i].remove(elem);
+            }
+            if (!removed)
+                return false;
+        }
+
+        --count;
+        if (divided && count <= capacity + 1)
+            merge();
+        updateReach();
+        return true;
+    }
+
+    // Move the element from to to, false if from was not found or to lies outside the tree. A remove
+    // and an insert, with the memory caveat of remove
+    bool update(const T &from, const T &to)
+    {
+        if (!boundary.contains(to.coord) || !remove(from))
+            return false;
+        return insert(to);
+    }
+
+    // Number of elements in the tree
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    // Center and half side of the root cube, an element is inserted when its center lies inside
+    const Math::Vec3<V> &center() const
+    {
+        return boundary.coord;
+    }
+
+    const V &depth() const
+    {
+        return boundary.depth;
+    }
+
+    // Remove every element and give all the storage back to the memory resource
+    void clear()
+    {
+        auto *resource = lstObjects.get_allocator().resource();
+        decltype(children){resource}.swap(children);
+        decltype(lstObjects){resource}.swap(lstObjects);
+        reach = V{};
+        count = 0;
+        divided = false;
     }
 
     void getNeighbors(const Math::Vec3<V> &coord, const V &depth, std::vector<T> &found) const
@@ -68,18 +162,122 @@ class Octree
         }
     }
 
+    // Elements whose sphere intersects the sphere (coord, radius)
+    void getIntersecting(const Math::Vec3<V> &coord, const V &radius, std::vector<T> &found) const
+    {
+        // Abort if the spheres held by this cube, all within reach of it, are out of range
+        const auto range = radius + reach;
+        if (boundary.distance2(coord) > range * range)
+            return;
+
+        for (const auto &elem : lstObjects)
+        {
+            if (touches(elem, coord, radius))
+            {
+                found.push_back(elem);
+            }
+        }
+
+        if (divided)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                children[i].getIntersecting(coord, radius, found);
+            }
+        }
+    }
+
+    // Element whose surface is the closest to coord, if closer than maxDist
+    std::optional<T> nearest(const Math::Vec3<V> &coord, V maxDist) const
+    {
+        const T *result = nullptr;
+        nearest(coord, maxDist, result);
+        if (result == nullptr)
+            return std::nullopt;
+        return *result;
+    }
+
   private:
+    void nearest(const Math::Vec3<V> &coord, V &best, const T *&result) const
+    {
+        if (count == 0 || std::sqrt(boundary.distance2(coord)) - reach >= best)
+            return;
+
+        for (const auto &elem : lstObjects)
+        {
+            const auto dist = Math::Distance(elem.coord, coord) - elem.radius;
+            if (dist < best)
+            {
+                best = dist;
+                result = &elem;
+            }
+        }
+
+        if (divided)
+        {
+            // Start with the child holding coord, it gives the tightest bound
+            const auto first = (coord.x > boundary.coord.x ? 4 : 0) | (coord.y > boundary.coord.y ? 2 : 0) |
+                               (coord.z > boundary.coord.z ? 1 : 0);
+            children[first].nearest(coord, best, result);
+            for (int i = 0; i < 8; ++i)
+            {
+                if (i != first)
+                    children[i].nearest(coord, best, result);
+            }
+        }
+    }
+
+    static bool same(const T &lhs, const T &rhs)
+    {
+        return lhs.coord.x == rhs.coord.x && lhs.coord.y == rhs.coord.y && lhs.coord.z == rhs.coord.z &&
+               lhs.radius == rhs.radius;
+    }
+
+    void collect(std::pmr::vector<T> &found) const
+    {
+        found.insert(found.end(), lstObjects.cbegin(), lstObjects.cend());
+        for (const auto &child : children)
+        {
+            child.collect(found);
+        }
+    }
+
+    // Bring the elements of the children back into this cube
+    void merge()
+    {
+        for (const auto &child : children)
+        {
+            child.collect(lstObjects);
+        }
+        children.clear();
+        divided = false;
+    }
+
+    void updateReach()
+    {
+        reach = V{};
+        for (const auto &elem : lstObjects)
+        {
+            reach = std::max(reach, elem.radius);
+        }
+        for (const auto &child : children)
+        {
+            reach = std::max(reach, child.reach);
+        }
+    }
+
     void subdivide()
     {
         auto newOrigin = boundary.coord;
         const auto new_depth = boundary.depth * .5;
 
+        children.reserve(8);
         for (int i = 0; i < 8; ++i)
         {
-            newOrigin.x = new_depth * (i & 4 ? .5 : -.5);
-            newOrigin.y = new_depth * (i & 2 ? .5 : -.5);
-            newOrigin.z = new_depth * (i & 1 ? .5 : -.5);
-            children.push_back(Octree<T>(newOrigin, new_depth));
+            newOrigin.x = boundary.coord.x + (i & 4 ? new_depth : -new_depth);
+            newOrigin.y = boundary.coord.y + (i & 2 ? new_depth : -new_depth);
+            newOrigin.z = boundary.coord.z + (i & 1 ? new_depth : -new_depth);
+            children.emplace_back(newOrigin, new_depth, capacity, children.get_allocator().resource());
         }
 
         divided = 1;
@@ -97,12 +295,20 @@ class Octree
             return (p_coord >= coord - depth_v) && (p_coord <= coord + depth_v);
         }
 
+        // Squared euclidean distance from a point to the cube, 0 inside
+        V distance2(const Math::Vec3<V> &p_coord) const
+        {
+            const auto dx = std::max(std::abs(p_coord.x - coord.x) - depth, V{0});
+            const auto dy = std::max(std::abs(p_coord.y - coord.y) - depth, V{0});
+            const auto dz = std::max(std::abs(p_coord.z - coord.z) - depth, V{0});
+            return dx * dx + dy * dy + dz * dz;
+        }
+
         constexpr bool intersects(const Cube &other) const
         {
-            const Math::Vec3<V> other_depth_vec{depth, depth, depth};
-            const Math::Vec3<V> depth_vec{other.depth, other.depth, other.depth};
-            return !(other.coord - other_depth_vec >= coord + depth_vec ||
-                     other.coord + other_depth_vec <= coord - depth_vec);
+            const auto reach = depth + other.depth;
+            return std::abs(coord.x - other.coord.x) <= reach && std::abs(coord.y - other.coord.y) <= reach &&
+                   std::abs(coord.z - other.coord.z) <= reach;
         }
     };
 
@@ -111,9 +317,13 @@ class Octree
 
     unsigned int capacity; // Capacity of each cube
 
-    std::vector<T> lstObjects{};
+    V reach{}; // Largest radius of the elements of this cube and its children
+
+    std::size_t count{}; // Number of elements of this cube and its children
+
+    std::pmr::vector<T> lstObjects;
 
-    std::vector<Octree<T>> children{};
+    std::pmr::vector<Octree<T, V>> children;
 
     bool divided;
 };
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace Parallel
+{
+
+// Number of worker threads to use, never less than one
+inline unsigned int concurrency()
+{
+    const auto hw = std::thread::hardware_concurrency();
+    return hw == 0 ? 1 : hw;
+}
+
+// Split [0, count) in nbChunks contiguous ranges and call f(chunk, begin, end) on each of them,
+// the last chunk being run on the calling thread
+template <typename F>
+void forChunks(std::size_t count, unsigned int nbChunks, F &&f)
+{
+    nbChunks = static_cast<unsigned int>(std::max<std::size_t>(1, std::min<std::size_t>(nbChunks, count)));
+    const auto chunkSize = count / nbChunks;
+
+    std::vector<std::thread> workers{};
+    workers.reserve(nbChunks - 1);
+    for (unsigned int c = 0; c + 1 < nbChunks; ++c)
+    {
+        workers.emplace_back([&f, c, chunkSize]() { f(c, c * chunkSize, (c + 1) * chunkSize); });
+    }
+    f(nbChunks - 1, (nbChunks - 1) * chunkSize, count);
+
+    for (auto &w : workers)
+    {
+        w.join();
+    }
+}
+
+} // namespace Parallel
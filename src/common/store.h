@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Append-only storage read while it grows. A single writer appends and resets, any thread takes
+// snapshots: a consistent prefix of the elements, read in place without lock nor copy.
+//
+// The elements live in fixed size blocks that never move. The block table is replaced, not
+// modified, when a block is added, and the snapshots share it with the store. A reset starts a
+// new epoch with an empty table, the snapshots of the previous epochs keep their blocks alive.
+template <typename T, std::size_t BlockSize = 4096>
+class Store
+{
+    using Block = std::vector<T>; // Reserved once, its elements never move
+
+    struct Table
+    {
+        std::uint64_t epoch = 0;
+        std::vector<std::shared_ptr<Block>> blocks{};
+    };
+
+  public:
+    class Snapshot
+    {
+      public:
+        Snapshot() = default;
+
+        std::size_t size() const
+        {
+            return count;
+        }
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        // Number of resets of the store before the snapshot
+        std::uint64_t epoch() const
+        {
+            return table == nullptr ? 0 : table->epoch;
+        }
+
+        const T &operator[](std::size_t i) const
+        {
+            return table->blocks[i / BlockSize]->data()[i % BlockSize];
+        }
+
+        // Call f on each element in order, a block at a time
+        template <typename F>
+        void forEach(F &&f) const
+        {
+            for (std::size_t first = 0; first < count; first += BlockSize)
+            {
+                const auto *block = table->blocks[first / BlockSize]->data();
+                const auto last = std::min(count - first, BlockSize);
+                for (std::size_t i = 0; i < last; ++i)
+                {
+                    f(block[i]);
+                }
+            }
+        }
+
+      private:
+        friend class Store;
+
+        Snapshot(std::shared_ptr<const Table> table_, std::size_t count_) : table(std::move(table_)), count(count_)
+        {
+        }
+
+        std::shared_ptr<const Table> table{};
+        std::size_t count = 0;
+    };
+
+    Store() : table(std::make_shared<const Table>())
+    {
+    }
+
+    Store(const Store &) = delete;
+    Store &operator=(const Store &) = delete;
+
+    // Writer only: the element is visible to the snapshots taken after the call
+    void push_back(const T &elem)
+    {
+        const auto n = count.load(std::memory_order_relaxed);
+        if (n == capacity)
+            grow();
+
+        tail->push_back(elem);
+        count.store(n + 1, std::memory_order_release);
+    }
+
+    // Writer only: drop every element in a new epoch. The count is cleared first, a snapshot never
+    // pairs the empty table with a count of the previous epoch
+    void reset()
+    {
+        count.store(0, std::memory_order_release);
+        auto next = std::make_shared<Table>();
+        next->epoch = table->epoch + 1;
+        std::atomic_store(&table, std::shared_ptr<const Table>(std::move(next)));
+        capacity = 0;
+        tail = nullptr;
+    }
+
+    std::size_t size() const
+    {
+        return count.load(std::memory_order_acquire);
+    }
+
+    // Any thread: the elements appended so far, in the current epoch
+    Snapshot snapshot() const
+    {
+        // The writer publishes a table before the counts it covers, and clears the count before an
+        // empty table, so the count read between two loads of the same table fits in that table
+        for (;;)
+        {
+            auto current = std::atomic_load(&table);
+            const auto n = count.load(std::memory_order_acquire);
+            if (std::atomic_load(&table) == current)
+                return Snapshot{std::move(current), n};
+        }
+    }
+
+  private:
+    void grow()
+    {
+        auto block = std::make_shared<Block>();
+        block->reserve(BlockSize);
+        tail = block.get();
+
+        auto next = std::make_shared<Table>(*table);
+        next->blocks.push_back(std::move(block));
+        std::atomic_store(&table, std::shared_ptr<const Table>(std::move(next)));
+        capacity += BlockSize;
+    }
+
+  private:
+    std::shared_ptr<const Table> table; // Loaded and stored atomically, the readers share it
+    std::atomic<std::size_t> count{0};
+    std::size_t capacity = 0; // Writer only
+    Block *tail = nullptr;    // Writer only, block receiving the next element
+};
\ No newline at end of file
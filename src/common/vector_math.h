@@ -33,6 +33,12 @@
 #include <cmath>
 #include <type_traits>
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace Math
 {
 
@@ -317,6 +323,32 @@ inline double Vec3<double>::Normalize()
 
 using Vec3f = Vec3<double>;
 
+// Fused helpers, no temporary vector is built
+
+template <typename T>
+constexpr T Dot(const Vec3<T> &a, const Vec3<T> &b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template <typename T>
+constexpr Vec3<T> Cross(const Vec3<T> &a, const Vec3<T> &b)
+{
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+template <typename T>
+constexpr T Distance2(const Vec3<T> &a, const Vec3<T> &b)
+{
+    const auto dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+    return dx * dx + dy * dy + dz * dz;
+}
+
+inline double Distance(const Vec3<double> &a, const Vec3<double> &b)
+{
+    return std::sqrt(Distance2(a, b));
+}
+
 template <typename T>
 class Vec4
 {
@@ -425,6 +457,249 @@ class Vec4
     }
 };
 
+namespace Detail
+{
+
+// Four packed doubles: one AVX register, two SSE2 registers or plain scalars
+#if defined(__AVX__)
+struct Lanes
+{
+    __m256d v;
+
+    static Lanes load(const double *p)
+    {
+        return {_mm256_load_pd(p)};
+    }
+    static Lanes make(double x, double y, double z, double w)
+    {
+        return {_mm256_set_pd(w, z, y, x)};
+    }
+    static Lanes set(double f)
+    {
+        return {_mm256_set1_pd(f)};
+    }
+    void store(double *p) const
+    {
+        _mm256_store_pd(p, v);
+    }
+    friend Lanes operator+(Lanes a, Lanes b)
+    {
+        return {_mm256_add_pd(a.v, b.v)};
+    }
+    friend Lanes operator-(Lanes a, Lanes b)
+    {
+        return {_mm256_sub_pd(a.v, b.v)};
+    }
+    friend Lanes operator*(Lanes a, Lanes b)
+    {
+        return {_mm256_mul_pd(a.v, b.v)};
+    }
+    friend Lanes operator/(Lanes a, Lanes b)
+    {
+        return {_mm256_div_pd(a.v, b.v)};
+    }
+};
+#elif defined(__SSE2__)
+struct Lanes
+{
+    __m128d lo, hi;
+
+    static Lanes load(const double *p)
+    {
+        return {_mm_load_pd(p), _mm_load_pd(p + 2)};
+    }
+    static Lanes make(double x, double y, double z, double w)
+    {
+        return {_mm_set_pd(y, x), _mm_set_pd(w, z)};
+    }
+    static Lanes set(double f)
+    {
+        return {_mm_set1_pd(f), _mm_set1_pd(f)};
+    }
+    void store(double *p) const
+    {
+        _mm_store_pd(p, lo);
+        _mm_store_pd(p + 2, hi);
+    }
+    friend Lanes operator+(Lanes a, Lanes b)
+    {
+        return {_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)};
+    }
+    friend Lanes operator-(Lanes a, Lanes b)
+    {
+        return {_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)};
+    }
+    friend Lanes operator*(Lanes a, Lanes b)
+    {
+        return {_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)};
+    }
+    friend Lanes operator/(Lanes a, Lanes b)
+    {
+        return {_mm_div_pd(a.lo, b.lo), _mm_div_pd(a.hi, b.hi)};
+    }
+};
+#else
+struct Lanes
+{
+    double v[4];
+
+    static Lanes load(const double *p)
+    {
+        return {{p[0], p[1], p[2], p[3]}};
+    }
+    static Lanes make(double x, double y, double z, double w)
+    {
+        return {{x, y, z, w}};
+    }
+    static Lanes set(double f)
+    {
+        return {{f, f, f, f}};
+    }
+    void store(double *p) const
+    {
+        for (int i = 0; i < 4; ++i)
+            p[i] = v[i];
+    }
+    friend Lanes operator+(Lanes a, Lanes b)
+    {
+        return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+    }
+    friend Lanes operator-(Lanes a, Lanes b)
+    {
+        return {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+    }
+    friend Lanes operator*(Lanes a, Lanes b)
+    {
+        return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}};
+    }
+    friend Lanes operator/(Lanes a, Lanes b)
+    {
+        return {{a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]}};
+    }
+};
+#endif
+
+} // namespace Detail
+
+// Packed and 32 bytes aligned, the arithmetic runs on all the lanes at once. Same interface as
+// the generic Vec4, only the default constructor is constexpr
+template <>
+class alignas(32) Vec4<double>
+{
+  public:
+    double x{};
+    double y{};
+    double z{};
+    double w{};
+
+    constexpr Vec4() = default;
+
+    // Written as a whole, the following packed loads are forwarded from this store
+    Vec4(const double &x_, const double &y_, const double &z_, const double &w_)
+    {
+        Detail::Lanes::make(x_, y_, z_, w_).store(&x);
+    }
+
+    // Four consecutive doubles from a 32 bytes aligned address
+    static Vec4 Load(const double *p)
+    {
+        return Vec4{Detail::Lanes::load(p)};
+    }
+
+    template <typename T2>
+    Vec4<T2> Cast() const
+    {
+        return Vec4<T2>(static_cast<T2>(x), static_cast<T2>(y), static_cast<T2>(z), static_cast<T2>(w));
+    }
+
+    static Vec4 AssignToAll(const double &f)
+    {
+        return Vec4{Detail::Lanes::set(f)};
+    }
+
+    Vec4 operator+(const Vec4 &other) const
+    {
+        return Vec4{lanes() + other.lanes()};
+    }
+
+    Vec4 &operator+=(const Vec4 &other)
+    {
+        return *this = *this + other;
+    }
+
+    Vec4 operator-(const Vec4 &other) const
+    {
+        return Vec4{lanes() - other.lanes()};
+    }
+
+    Vec4 &operator-=(const Vec4 &other)
+    {
+        return *this = *this - other;
+    }
+
+    Vec4 operator*(const Vec4 &other) const
+    {
+        return Vec4{lanes() * other.lanes()};
+    }
+
+    Vec4 operator*(const double &f) const
+    {
+        return Vec4{lanes() * Detail::Lanes::set(f)};
+    }
+
+    Vec4 &operator*=(const double &f)
+    {
+        return *this = *this * f;
+    }
+
+    Vec4 operator/(const double &f) const
+    {
+        return Vec4{lanes() / Detail::Lanes::set(f)};
+    }
+
+    Vec4 &operator/=(const double &f)
+    {
+        return *this = *this / f;
+    }
+
+    double Length2() const
+    {
+        const auto p = *this * *this;
+        return p.x + p.y + p.z + p.w;
+    }
+
+    constexpr double &operator[](std::size_t i)
+    {
+        return *((&x) + i);
+    }
+
+    constexpr const double &operator[](std::size_t i) const
+    {
+        return *((&x) + i);
+    }
+
+    constexpr void SetZero()
+    {
+        x = 0;
+        y = 0;
+        z = 0;
+        w = 0;
+    }
+
+  private:
+    explicit Vec4(const Detail::Lanes &l)
+    {
+        l.store(&x);
+    }
+
+    Detail::Lanes lanes() const
+    {
+        return Detail::Lanes::load(&x);
+    }
+};
+
+static_assert(sizeof(Vec4<double>) == 4 * sizeof(double), "Vec4<double> must stay packed");
+
 // Utility vector factories
 template <typename T>
 constexpr Vec2<T> MakeVec(const T &x, const T &y)
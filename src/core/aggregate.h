@@ -1,7 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <utility>
 #include <vector>
 
+#include "common/math_utils.h"
 #include "common/octree.h"
 #include "common/vector_math.h"
 
@@ -10,15 +17,175 @@
 namespace Agg
 {
 
+// Sort the spheres after the first one (the root) along a Morton curve of their bounding box,
+// neighbor spheres end up close in memory
 template <typename T>
+void mortonSort(std::vector<T> &spheres)
+{
+    if (spheres.size() < 3)
+        return;
+
+    auto lower = spheres[1].coord, upper = spheres[1].coord;
+    for (auto it = spheres.cbegin() + 1; it != spheres.cend(); ++it)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            lower[k] = std::min(lower[k], it->coord[k]);
+            upper[k] = std::max(upper[k], it->coord[k]);
+        }
+    }
+    const auto extent = std::max({upper[0] - lower[0], upper[1] - lower[1], upper[2] - lower[2], 1e-300});
+    const auto scale = ((1 << 21) - 1) / extent;
+
+    std::vector<std::pair<std::uint64_t, std::size_t>> keys{};
+    keys.reserve(spheres.size() - 1);
+    for (std::size_t i = 1; i < spheres.size(); ++i)
+    {
+        const auto p = (spheres[i].coord - lower) * scale;
+        keys.emplace_back(Math::morton3(static_cast<std::uint32_t>(p[0]), static_cast<std::uint32_t>(p[1]),
+                                        static_cast<std::uint32_t>(p[2])),
+                          i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    const auto unsorted = spheres;
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        spheres[i + 1] = unsorted[keys[i].second];
+    }
+}
+
+// Heap memory held through it, the blocks of an arena
+class CountingResource : public std::pmr::memory_resource
+{
+  public:
+    std::size_t size() const
+    {
+        return bytes;
+    }
+
+  private:
+    void *do_allocate(std::size_t n, std::size_t alignment) override
+    {
+        auto *p = std::pmr::new_delete_resource()->allocate(n, alignment);
+        bytes += n;
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t n, std::size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(p, n, alignment);
+        bytes -= n;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::size_t bytes = 0;
+};
+
+template <typename T, typename Index = Octree<T>>
 struct Aggregate
 {
     T root;
     std::vector<T> objects{};
-    Octree<T> octree;
 
-    Aggregate() : root({{0, 0, 0}, 5}), octree(root.coord, 500.0){};
-    Aggregate(const T &core, const double depth) : root(core), octree(root.coord, depth){};
+    // The octree nodes live in the arena, dropped at once by reset. Its deallocations do nothing,
+    // the octree is only grown between two resets, never removed from
+    std::unique_ptr<CountingResource> heap;
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena;
+    Index octree;
+
+    Aggregate() : Aggregate({{0, 0, 0}, 5}, 500.0){};
+    Aggregate(const T &core, const double depth)
+        : root(core), heap(std::make_unique<CountingResource>()),
+          arena(std::make_unique<std::pmr::monotonic_buffer_resource>(arenaBlock, heap.get())),
+          octree(root.coord, depth, 4, arena.get()){};
+
+    // Memory of the octree
+    std::size_t indexBytes() const
+    {
+        return heap->size();
+    }
+
+    // Remove every sphere, the memory of the tree is given back at once
+    void reset()
+    {
+        objects.clear();
+        octree.clear();
+        arena->release();
+    }
+
+    // Index a sphere not yet in objects. The root cube of the octree doubles around its center
+    // until it holds the sphere, the spheres of objects being indexed again. False when no cube can,
+    // for a sphere with non finite coordinates
+    bool index(const T &sphere)
+    {
+        if (octree.insert(sphere))
+            return true;
+
+        const auto depth = fit(octree.depth(), sphere);
+        if (!std::isfinite(depth))
+            return false;
+        rebuild(depth);
+        return octree.insert(sphere);
+    }
+
+    // Index the spheres of objects again, in a root cube grown to hold them all. False when one of
+    // them cannot be held
+    bool reindex()
+    {
+        auto depth = octree.depth();
+        for (const auto &s : objects)
+        {
+            depth = fit(depth, s);
+        }
+        if (!std::isfinite(depth))
+            return false;
+        rebuild(depth);
+        return true;
+    }
+
+    // Sort the spheres along a Morton curve and rebuild the octree in that order, its nodes and
+    // leaves are then laid out in the arena following space. The root stays first
+    void reorder()
+    {
+        mortonSort(objects);
+        reindex();
+    }
+
+    static constexpr std::size_t arenaBlock = 1 << 16;
+
+  private:
+    // Half side of the root cube, doubled from depth until it holds the center of sphere
+    double fit(double depth, const T &sphere) const
+    {
+        const auto offset = sphere.coord - octree.center();
+        const auto far = std::max({std::abs(offset[0]), std::abs(offset[1]), std::abs(offset[2])});
+        if (!std::isfinite(far))
+            return far;
+        while (depth < far)
+        {
+            depth *= 2;
+        }
+        return depth;
+    }
+
+    // Empty the octree, with a root cube of half side depth, and insert objects in it
+    void rebuild(double depth)
+    {
+        const auto center = octree.center();
+        octree.clear();
+        arena->release();
+        if (depth != octree.depth())
+            octree = Index(center, depth, 4, arena.get());
+        for (const auto &s : objects)
+        {
+            octree.insert(s);
+        }
+    }
 };
 
 } // namespace Agg
\ No newline at end of file
@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "analysis.h"
+
+namespace Agg::Analysis
+{
+
+namespace
+{
+
+constexpr double pi = 3.14159265358979323846;
+
+inline std::size_t popcount(std::uint64_t word)
+{
+    return std::bitset<64>{word}.count();
+}
+
+// Index of the lowest set bit of a non zero word
+inline std::size_t lowest(std::uint64_t word)
+{
+    return popcount((word & (~word + 1)) - 1);
+}
+
+// Solid voxels in the shells of a density profile
+struct Profile
+{
+    Vec3d center{};
+    double width{};
+    std::vector<std::size_t> counts{};
+
+    std::size_t shellOf(double dist) const
+    {
+        return std::min(static_cast<std::size_t>(dist / width), counts.size() - 1);
+    }
+
+    // The solid voxels [x0, x1] of a row at squared distance q from the center across the row. The
+    // voxels closer than each shell boundary form an interval, found with a square root per
+    // boundary crossed instead of one per voxel
+    void addRun(const Grid &grid, std::size_t x0, std::size_t x1, double q)
+    {
+        const auto offset = grid.origin.x + 0.5 * grid.voxel - center.x; // dx of the voxel 0
+        const auto dx0 = offset + x0 * grid.voxel, dx1 = offset + x1 * grid.voxel;
+        const auto near = dx0 <= 0.0 && dx1 >= 0.0 ? 0.0 : std::min(std::abs(dx0), std::abs(dx1));
+        const auto far = std::max(std::abs(dx0), std::abs(dx1));
+        const auto first = shellOf(std::sqrt(q + near * near)), last = shellOf(std::sqrt(q + far * far));
+        const auto total = static_cast<double>(x1 - x0 + 1);
+
+        double closer = 0.0; // Voxels of the run in the shells before
+        for (auto k = first; k < last; ++k)
+        {
+            const auto outer = (k + 1) * width;
+            const auto t2 = outer * outer - q;
+            double inside = 0.0;
+            if (t2 > 0.0)
+            {
+                // |offset + x voxel| < t
+                const auto t = std::sqrt(t2);
+                const auto lo = std::max(std::floor((-t - offset) / grid.voxel) + 1, static_cast<double>(x0));
+                const auto hi = std::min(std::ceil((t - offset) / grid.voxel) - 1, static_cast<double>(x1));
+                inside = std::max(hi - lo + 1, closer);
+            }
+            counts[k] += static_cast<std::size_t>(inside - closer);
+            closer = inside;
+        }
+        counts[last] += static_cast<std::size_t>(total - closer);
+    }
+};
+
+// Valid bits of the word w of a row of nx voxels
+inline std::uint64_t validBits(const Grid &grid, std::size_t w)
+{
+    const auto used = grid.nx - 64 * w;
+    return used >= 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << used) - 1;
+}
+
+// Set the voxels [first, last] of a row
+void setRange(std::uint64_t *row, std::size_t first, std::size_t last)
+{
+    const auto firstWord = first / 64, lastWord = last / 64;
+    const auto low = ~std::uint64_t{0} << (first % 64);
+    const auto high = ~std::uint64_t{0} >> (63 - last % 64);
+    if (firstWord == lastWord)
+    {
+        row[firstWord] |= low & high;
+        return;
+    }
+    row[firstWord] |= low;
+    std::fill(row + firstWord + 1, row + lastWord, ~std::uint64_t{0});
+    row[lastWord] |= high;
+}
+
+// Voxel indices whose center lies in [from, to] along an axis, false when none
+bool span(double from, double to, double origin, double voxel, std::size_t count, std::size_t &first,
+          std::size_t &last)
+{
+    const auto lo = std::ceil((from - origin) / voxel - 0.5), hi = std::floor((to - origin) / voxel - 0.5);
+    if (hi < lo || hi < 0 || lo >= static_cast<double>(count))
+        return false;
+    first = static_cast<std::size_t>(std::max(lo, 0.0));
+    last = std::min(static_cast<std::size_t>(hi), count - 1);
+    return true;
+}
+
+void rasterize(Grid &grid, const Sphere &sphere, std::size_t zBegin, std::size_t zEnd)
+{
+    const auto &c = sphere.coord;
+    const auto r2 = sphere.radius * sphere.radius;
+    std::size_t z0, z1;
+    if (!span(c.z - sphere.radius, c.z + sphere.radius, grid.origin.z, grid.voxel, grid.nz, z0, z1))
+        return;
+
+    for (auto z = std::max(z0, zBegin); z <= z1 && z < zEnd; ++z)
+    {
+        const auto dz = grid.origin.z + (z + 0.5) * grid.voxel - c.z;
+        const auto ry = std::sqrt(std::max(r2 - dz * dz, 0.0));
+        std::size_t y0, y1;
+        if (!span(c.y - ry, c.y + ry, grid.origin.y, grid.voxel, grid.ny, y0, y1))
+            continue;
+
+        for (auto y = y0; y <= y1; ++y)
+        {
+            const auto dy = grid.origin.y + (y + 0.5) * grid.voxel - c.y;
+            const auto rx2 = r2 - dz * dz - dy * dy;
+            if (rx2 < 0)
+                continue;
+            const auto rx = std::sqrt(rx2);
+            std::size_t x0, x1;
+            if (span(c.x - rx, c.x + rx, grid.origin.x, grid.voxel, grid.nx, x0, x1))
+                setRange(grid.solid.data() + grid.row(y, z), x0, x1);
+        }
+    }
+}
+
+// Spread the exterior voxels of a row along the runs of empty voxels holding them. Each word is
+// filled upward then downward by doubling shifts, the runs crossing words by a carry
+void fillRow(const Grid &grid, const std::uint64_t *solid, std::uint64_t *exterior)
+{
+    const auto fillUp = [](std::uint64_t e, std::uint64_t m) {
+        for (int k = 1; k < 64; k *= 2)
+        {
+            e |= (e << k) & m;
+            m &= m << k;
+        }
+        return e;
+    };
+    const auto fillDown = [](std::uint64_t e, std::uint64_t m) {
+        for (int k = 1; k < 64; k *= 2)
+        {
+            e |= (e >> k) & m;
+            m &= m >> k;
+        }
+        return e;
+    };
+
+    for (std::size_t w = 0; w < grid.words; ++w)
+    {
+        const auto valid = validBits(grid, w), empty = ~solid[w] & valid;
+        if (w > 0 && exterior[w - 1] >> 63)
+            exterior[w] |= empty & 1;
+        // Most words are away from the spheres, a seed fills them at once
+        if (exterior[w] != 0)
+            exterior[w] = empty == valid ? valid : fillUp(exterior[w], empty);
+    }
+    for (auto w = grid.words; w-- > 0;)
+    {
+        const auto empty = ~solid[w] & validBits(grid, w);
+        if (w + 1 < grid.words && exterior[w + 1] & 1)
+            exterior[w] |= empty & (std::uint64_t{1} << 63);
+        if (exterior[w] != 0 && exterior[w] != empty)
+            exterior[w] = fillDown(exterior[w], empty);
+    }
+}
+
+} // namespace
+
+Grid voxelize(const std::vector<Sphere> &spheres, double voxel, unsigned int threads)
+{
+    Grid grid{};
+    grid.voxel = voxel;
+    if (spheres.empty())
+        return grid;
+
+    auto lo = spheres.front().coord, hi = lo;
+    for (const auto &s : spheres)
+    {
+        const Vec3d r{s.radius, s.radius, s.radius};
+        lo = Math::Vec3<double>{std::min(lo.x, s.coord.x - r.x), std::min(lo.y, s.coord.y - r.y),
+                                std::min(lo.z, s.coord.z - r.z)};
+        hi = Math::Vec3<double>{std::max(hi.x, s.coord.x + r.x), std::max(hi.y, s.coord.y + r.y),
+                                std::max(hi.z, s.coord.z + r.z)};
+    }
+
+    // One empty voxel beyond the spheres on each side
+    grid.origin = lo - Vec3d{voxel, voxel, voxel};
+    grid.nx = static_cast<std::size_t>(std::ceil((hi.x - lo.x) / voxel)) + 2;
+    grid.ny = static_cast<std::size_t>(std::ceil((hi.y - lo.y) / voxel)) + 2;
+    grid.nz = static_cast<std::size_t>(std::ceil((hi.z - lo.z) / voxel)) + 2;
+    grid.words = (grid.nx + 63) / 64;
+    grid.solid.assign(grid.words * grid.ny * grid.nz, 0);
+
+    // The slabs own their rows, the threads never write the same word
+    Parallel::forChunks(grid.nz, threads, [&](unsigned int, std::size_t zBegin, std::size_t zEnd) {
+        const auto bottom = grid.origin.z + zBegin * grid.voxel, top = grid.origin.z + zEnd * grid.voxel;
+        for (const auto &s : spheres)
+        {
+            if (s.coord.z + s.radius >= bottom && s.coord.z - s.radius <= top)
+                rasterize(grid, s, zBegin, zEnd);
+        }
+    });
+    return grid;
+}
+
+void markExterior(Grid &grid)
+{
+    grid.exterior.assign(grid.solid.size(), 0);
+    const auto nbRows = grid.ny * grid.nz;
+    if (nbRows == 0)
+        return;
+
+    // Every row starts from its empty ends, and spreads to its four neighbor rows when it grows
+    std::vector<std::size_t> pending{};
+    std::vector<char> queued(nbRows, 1);
+    pending.reserve(nbRows);
+    for (std::size_t r = nbRows; r-- > 0;)
+    {
+        auto *ext = grid.exterior.data() + r * grid.words;
+        const auto *solid = grid.solid.data() + r * grid.words;
+        ext[0] |= ~solid[0] & 1;
+        ext[grid.words - 1] |= ~solid[grid.words - 1] & (std::uint64_t{1} << ((grid.nx - 1) % 64));
+        pending.push_back(r);
+    }
+
+    while (!pending.empty())
+    {
+        const auto r = pending.back();
+        pending.pop_back();
+        queued[r] = 0;
+
+        auto *ext = grid.exterior.data() + r * grid.words;
+        fillRow(grid, grid.solid.data() + r * grid.words, ext);
+
+        const auto y = r % grid.ny, z = r / grid.ny;
+        const std::size_t neighbors[4] = {y > 0 ? r - 1 : nbRows, y + 1 < grid.ny ? r + 1 : nbRows,
+                                          z > 0 ? r - grid.ny : nbRows, z + 1 < grid.nz ? r + grid.ny : nbRows};
+        for (const auto q : neighbors)
+        {
+            if (q == nbRows)
+                continue;
+
+            auto *next = grid.exterior.data() + q * grid.words;
+            const auto *solid = grid.solid.data() + q * grid.words;
+            std::uint64_t grown = 0;
+            for (std::size_t w = 0; w < grid.words; ++w)
+            {
+                const auto add = ext[w] & ~solid[w] & ~next[w];
+                next[w] |= add;
+                grown |= add;
+            }
+            if (grown != 0 && !queued[q])
+            {
+                queued[q] = 1;
+                pending.push_back(q);
+            }
+        }
+    }
+}
+
+int analyze(const std::vector<Sphere> &spheres, double voxel, Result &result, std::size_t nbShells,
+            unsigned int threads)
+{
+    result.spheres = spheres.size();
+    result.voxel = voxel;
+    if (!(voxel > 0.0))
+    {
+        std::cerr << "The voxel side must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (spheres.empty())
+        return 0;
+
+    // Volume weighted center and enclosing sphere
+    Vec3d center{};
+    double weight = 0.0;
+    for (const auto &s : spheres)
+    {
+        const auto w = s.radius * s.radius * s.radius;
+        center += s.coord * w;
+        weight += w;
+    }
+    center = weight > 0.0 ? center / weight : spheres.front().coord;
+    for (const auto &s : spheres)
+    {
+        result.radius = std::max(result.radius, Math::Distance(s.coord, center) + s.radius);
+    }
+    if (!(result.radius > 0.0))
+        return 0;
+
+    const auto side = 2 * result.radius / voxel + 2;
+    if (side * side * side > static_cast<double>(maxVoxels))
+    {
+        std::cerr << "Voxels of side " << voxel << " are too small for an aggregate of radius " << result.radius
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto grid = voxelize(spheres, voxel, threads);
+    markExterior(grid);
+
+    // Counts of each slab, summed afterwards
+    nbShells = std::max<std::size_t>(nbShells, 1);
+    result.shell = result.radius / nbShells;
+    struct Counts
+    {
+        std::size_t solid = 0, faces = 0, exteriorFaces = 0, closed = 0;
+        Profile profile{};
+    };
+    std::vector<Counts> counts(std::max(1u, threads));
+
+    Parallel::forChunks(grid.nz, threads, [&](unsigned int chunk, std::size_t zBegin, std::size_t zEnd) {
+        auto &local = counts[chunk];
+        local.profile = {center, result.shell, std::vector<std::size_t>(nbShells, 0)};
+        const auto rowWords = grid.words;
+        const auto layer = grid.ny * rowWords;
+
+        for (auto z = zBegin; z < zEnd; ++z)
+        {
+            const auto dz = grid.origin.z + (z + 0.5) * voxel - center.z;
+            for (std::size_t y = 0; y < grid.ny; ++y)
+            {
+                const auto dy = grid.origin.y + (y + 0.5) * voxel - center.y;
+                const auto q = dy * dy + dz * dz;
+                const auto r = grid.row(y, z);
+                const auto *solid = grid.solid.data() + r;
+                const auto *ext = grid.exterior.data() + r;
+
+                // The padding keeps the solid voxels away from the boundary, their neighbor rows exist
+                std::uint64_t carrySolid = 0, carryExt = 0;
+                for (std::size_t w = 0; w < rowWords; ++w)
+                {
+                    const auto s = solid[w];
+                    const auto valid = validBits(grid, w);
+                    const auto closed = ~s & valid & ~ext[w];
+                    if (closed != 0)
+                        local.closed += popcount(closed);
+                    if (s == 0)
+                    {
+                        carrySolid = 0;
+                        carryExt = ext[w] >> 63;
+                        continue;
+                    }
+                    local.solid += popcount(s);
+
+                    // Empty and exterior neighbors along x, the bits of the next word carried in
+                    const auto nextSolid = w + 1 < rowWords ? solid[w + 1] & 1 : 0;
+                    const auto nextExt = w + 1 < rowWords ? ext[w + 1] & 1 : 0;
+                    const auto emptyLeft = ~((s << 1) | carrySolid), emptyRight = ~((s >> 1) | (nextSolid << 63));
+                    const auto extLeft = (ext[w] << 1) | carryExt, extRight = (ext[w] >> 1) | (nextExt << 63);
+                    local.faces += popcount(s & emptyLeft) + popcount(s & emptyRight);
+                    local.exteriorFaces += popcount(s & extLeft) + popcount(s & extRight);
+
+                    // Along y and z
+                    for (const auto offset : {rowWords, layer})
+                    {
+                        local.faces += popcount(s & ~solid[w - offset]) + popcount(s & ~solid[w + offset]);
+                        local.exteriorFaces += popcount(s & ext[w - offset]) + popcount(s & ext[w + offset]);
+                    }
+
+                    // Density profile, a run of solid voxels at a time
+                    for (auto bits = s; bits != 0;)
+                    {
+                        const auto first = lowest(bits);
+                        const auto rest = ~(bits >> first);
+                        const auto length = rest == 0 ? 64 : lowest(rest);
+                        local.profile.addRun(grid, 64 * w + first, 64 * w + first + length - 1, q);
+                        bits = first + length >= 64 ? 0 : bits & (~std::uint64_t{0} << (first + length));
+                    }
+
+                    carrySolid = s >> 63;
+                    carryExt = ext[w] >> 63;
+                }
+            }
+        }
+    });
+
+    Counts total{};
+    total.profile.counts.assign(nbShells, 0);
+    for (const auto &c : counts)
+    {
+        total.solid += c.solid;
+        total.faces += c.faces;
+        total.exteriorFaces += c.exteriorFaces;
+        total.closed += c.closed;
+        for (std::size_t i = 0; i < c.profile.counts.size(); ++i)
+        {
+            total.profile.counts[i] += c.profile.counts[i];
+        }
+    }
+
+    const auto cell = voxel * voxel * voxel;
+    result.volume = total.solid * cell;
+    result.surface = total.faces * voxel * voxel * 2 / 3;
+    result.accessibleSurface = total.exteriorFaces * voxel * voxel * 2 / 3;
+    result.closedPores = total.closed * cell;
+    result.porosity = 1 - result.volume / (4 * pi / 3 * std::pow(result.radius, 3));
+    result.density.resize(nbShells);
+    for (std::size_t i = 0; i < nbShells; ++i)
+    {
+        const auto inner = i * result.shell, outer = (i + 1) * result.shell;
+        result.density[i] = total.profile.counts[i] * cell / (4 * pi / 3 * (std::pow(outer, 3) - std::pow(inner, 3)));
+    }
+    return 0;
+}
+
+int writeAnalysis(const std::string &fileName, const std::vector<Result> &results)
+{
+    std::ofstream file{fileName};
+    file.precision(std::numeric_limits<double>::max_digits10);
+    file << "# id spheres voxel volume surface accessible_surface closed_pores radius porosity\n";
+    for (const auto &r : results)
+    {
+        file << r.id << ' ' << r.spheres << ' ' << r.voxel << ' ' << r.volume << ' ' << r.surface << ' '
+             << r.accessibleSurface << ' ' << r.closedPores << ' ' << r.radius << ' ' << r.porosity << '\n';
+    }
+
+    file << "# id shell_inner shell_outer density\n";
+    for (const auto &r : results)
+    {
+        for (std::size_t i = 0; i < r.density.size(); ++i)
+        {
+            file << r.id << ' ' << i * r.shell << ' ' << (i + 1) * r.shell << ' ' << r.density[i] << '\n';
+        }
+    }
+
+    file.close();
+    if (!file)
+    {
+        std::cerr << "Cannot write the analysis in " << fileName << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+std::string format(const Result &result)
+{
+    std::ostringstream text{};
+    text << "Volume: " << result.volume << ", surface: " << result.surface
+         << ", accessible surface: " << result.accessibleSurface << ", closed pores: " << result.closedPores
+         << ", porosity: " << result.porosity << " in a radius of " << result.radius;
+    return text.str();
+}
+
+} // namespace Agg::Analysis
\ No newline at end of file
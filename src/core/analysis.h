@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sphere.h"
+
+#include "common/parallel.h"
+#include "common/vector_math.h"
+
+namespace Agg::Analysis
+{
+
+using Vec3d = Math::Vec3<double>;
+using Sphere = Agg::Object::Sphere<double>;
+
+// Cubic voxels of an aggregate, one bit each. A voxel is solid when its center lies in a sphere.
+// The rows along x are packed in 64 bit words, and a layer of empty voxels surrounds the spheres.
+struct Grid
+{
+    Vec3d origin{}; // Corner of the voxel (0, 0, 0)
+    double voxel = 0.0;
+    std::size_t nx = 0, ny = 0, nz = 0;
+    std::size_t words = 0; // Words per row
+
+    std::vector<std::uint64_t> solid{};
+    std::vector<std::uint64_t> exterior{}; // Empty voxels connected to the boundary, see markExterior
+
+    // First word of the row (y, z)
+    std::size_t row(std::size_t y, std::size_t z) const
+    {
+        return (z * ny + y) * words;
+    }
+
+    bool isSolid(std::size_t x, std::size_t y, std::size_t z) const
+    {
+        return solid[row(y, z) + x / 64] >> (x % 64) & 1;
+    }
+
+    bool isExterior(std::size_t x, std::size_t y, std::size_t z) const
+    {
+        return exterior[row(y, z) + x / 64] >> (x % 64) & 1;
+    }
+
+    Vec3d center(std::size_t x, std::size_t y, std::size_t z) const
+    {
+        return origin + Vec3d{x + 0.5, y + 0.5, z + 0.5} * voxel;
+    }
+};
+
+// Largest grid accepted by analyze, about 8 GB of bits
+constexpr std::size_t maxVoxels = std::size_t{1} << 35;
+
+// Voxels of the spheres, each thread filling its own slab of layers along z
+Grid voxelize(const std::vector<Sphere> &spheres, double voxel, unsigned int threads = Parallel::concurrency());
+
+// Flood fill of the empty voxels from the boundary of the grid, a row at a time
+void markExterior(Grid &grid);
+
+struct Result
+{
+    std::uint64_t id{}; // Ensemble member, 0 for a single aggregate
+    std::uint64_t spheres{};
+    double voxel{};
+    double volume{};            // Solid voxels
+    double surface{};           // Faces between solid and empty voxels, times 2/3 (see below)
+    double accessibleSurface{}; // Faces between solid and exterior voxels, times 2/3
+    double closedPores{};       // Empty voxels enclosed by the aggregate
+    double radius{};            // Enclosing sphere around the volume weighted center of the spheres
+    double porosity{};          // Empty part of the enclosing sphere
+    double shell{};             // Width of the shells of the density profile
+    std::vector<double> density{}; // Solid part of each shell around the center
+};
+
+// Voxel counts of a surface are 3/2 larger than its area on average over the orientations, the
+// faces are scaled by 2/3. Returns 0 on success
+int analyze(const std::vector<Sphere> &spheres, double voxel, Result &result, std::size_t nbShells = 50,
+            unsigned int threads = Parallel::concurrency());
+
+// Analysis written next to the aggregate
+inline std::string analysisFile(const std::string &output)
+{
+    return output + ".analysis";
+}
+
+// The results of each aggregate, then their density profiles. Returns 0 on success
+int writeAnalysis(const std::string &fileName, const std::vector<Result> &results);
+
+// One line summary
+std::string format(const Result &result);
+
+} // namespace Agg::Analysis
\ No newline at end of file
@@ -0,0 +1,446 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+
+#include "aggregate.h"
+#include "archive.h"
+
+#include "common/math_utils.h"
+#include "common/parallel.h"
+
+#ifdef AGG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace Agg::File
+{
+
+namespace
+{
+
+using Sphere = Agg::Object::Sphere<double>;
+
+constexpr char magic[4] = {'A', 'G', 'G', 'Z'};
+constexpr std::uint32_t version = 1;
+constexpr std::size_t headerSize = sizeof(magic) + sizeof(version);
+constexpr std::size_t footerSize = sizeof(std::uint64_t) + sizeof(magic);
+
+// Stored sizes of the table records, their fields packed in declaration order
+constexpr std::size_t blockBytes = 8 + 4 * 4;
+constexpr std::size_t memberBytes = 3 * 8 + 4 * 4 + 8;
+
+// Integers, enums and doubles of the headers and tables are little endian whatever the host order,
+// written and read byte by byte
+template <typename V>
+inline void store(std::string &out, V value)
+{
+    if constexpr (std::is_enum_v<V>)
+        store(out, static_cast<std::underlying_type_t<V>>(value));
+    else if constexpr (std::is_floating_point_v<V>)
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        store(out, bits);
+    }
+    else
+    {
+        for (unsigned int shift = 0; shift < 8 * sizeof(V); shift += 8)
+        {
+            out.push_back(static_cast<char>((value >> shift) & 0xff));
+        }
+    }
+}
+
+template <typename V>
+inline V load(const char *data)
+{
+    if constexpr (std::is_enum_v<V>)
+        return static_cast<V>(load<std::underlying_type_t<V>>(data));
+    else if constexpr (std::is_floating_point_v<V>)
+    {
+        const auto bits = load<std::uint64_t>(data);
+        V value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    else
+    {
+        V value{};
+        for (std::size_t i = 0; i < sizeof(V); ++i)
+        {
+            value |= static_cast<V>(static_cast<unsigned char>(data[i])) << (8 * i);
+        }
+        return value;
+    }
+}
+
+void store(std::string &out, const ArchiveBlock &block)
+{
+    store(out, block.offset);
+    store(out, block.size);
+    store(out, block.rawSize);
+    store(out, block.count);
+    store(out, block.reserved);
+}
+
+ArchiveBlock loadBlock(const char *data)
+{
+    ArchiveBlock block{};
+    block.offset = load<std::uint64_t>(data);
+    block.size = load<std::uint32_t>(data + 8);
+    block.rawSize = load<std::uint32_t>(data + 12);
+    block.count = load<std::uint32_t>(data + 16);
+    block.reserved = load<std::uint32_t>(data + 20);
+    return block;
+}
+
+void store(std::string &out, const ArchiveMember &member)
+{
+    store(out, member.id);
+    store(out, member.nbSpheres);
+    store(out, member.quantum);
+    store(out, member.order);
+    store(out, member.codec);
+    store(out, member.nbBlocks);
+    store(out, member.reserved);
+    store(out, member.tableOffset);
+}
+
+ArchiveMember loadMember(const char *data)
+{
+    ArchiveMember member{};
+    member.id = load<std::uint64_t>(data);
+    member.nbSpheres = load<std::uint64_t>(data + 8);
+    member.quantum = load<double>(data + 16);
+    member.order = load<ArchiveOrder>(data + 24);
+    member.codec = load<ArchiveCodec>(data + 28);
+    member.nbBlocks = load<std::uint32_t>(data + 32);
+    member.reserved = load<std::uint32_t>(data + 36);
+    member.tableOffset = load<std::uint64_t>(data + 40);
+    return member;
+}
+
+inline std::uint64_t zigzag(std::int64_t v)
+{
+    return (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63);
+}
+
+inline std::int64_t unzigzag(std::uint64_t v)
+{
+    return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1);
+}
+
+inline void putVarint(std::string &out, std::uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+inline bool getVarint(const char *&curr, const char *end, std::uint64_t &v)
+{
+    v = 0;
+    for (unsigned int shift = 0; curr != end && shift < 64; shift += 7)
+    {
+        const auto byte = static_cast<unsigned char>(*curr++);
+        v |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80)
+            return true;
+    }
+    return false;
+}
+
+inline std::int64_t quantize(double v, double quantum)
+{
+    return std::llround(v / quantum);
+}
+
+// Varints of the deltas between consecutive quantized spheres, the first one relative to zero
+void encodeBlock(const Sphere *first, const Sphere *last, double quantum, std::string &raw)
+{
+    raw.clear();
+    std::int64_t prev[4] = {0, 0, 0, 0};
+    for (auto s = first; s != last; ++s)
+    {
+        const std::int64_t curr[4] = {quantize(s->coord[0], quantum), quantize(s->coord[1], quantum),
+                                      quantize(s->coord[2], quantum), quantize(s->radius, quantum)};
+        for (int k = 0; k < 4; ++k)
+        {
+            putVarint(raw, zigzag(curr[k] - prev[k]));
+            prev[k] = curr[k];
+        }
+    }
+}
+
+bool decodeBlock(const char *curr, const char *end, std::uint32_t count, double quantum,
+                 std::vector<Sphere> &spheres)
+{
+    std::int64_t prev[4] = {0, 0, 0, 0};
+    for (std::uint32_t i = 0; i < count; ++i)
+    {
+        for (int k = 0; k < 4; ++k)
+        {
+            std::uint64_t v;
+            if (!getVarint(curr, end, v))
+                return false;
+            prev[k] += unzigzag(v);
+        }
+        spheres.emplace_back(Math::Vec3<double>{prev[0] * quantum, prev[1] * quantum, prev[2] * quantum},
+                             prev[3] * quantum);
+    }
+    return curr == end;
+}
+
+// Blocks whose compressed form is not smaller are stored as is (size == rawSize)
+void compressBlock(const std::string &raw, std::string &stored, ArchiveCodec codec)
+{
+#ifdef AGG_HAVE_ZLIB
+    if (codec == ArchiveCodec::Zlib)
+    {
+        auto bound = compressBound(static_cast<uLong>(raw.size()));
+        stored.resize(bound);
+        if (compress2(reinterpret_cast<Bytef *>(stored.data()), &bound,
+                      reinterpret_cast<const Bytef *>(raw.data()), static_cast<uLong>(raw.size()),
+                      Z_DEFAULT_COMPRESSION) == Z_OK &&
+            bound < raw.size())
+        {
+            stored.resize(bound);
+            return;
+        }
+    }
+#endif
+    (void)codec;
+    stored = raw;
+}
+
+bool uncompressBlock(const char *data, const ArchiveBlock &block, std::string &raw)
+{
+#ifdef AGG_HAVE_ZLIB
+    raw.resize(block.rawSize);
+    uLongf rawSize = block.rawSize;
+    return uncompress(reinterpret_cast<Bytef *>(raw.data()), &rawSize, reinterpret_cast<const Bytef *>(data),
+                      block.size) == Z_OK &&
+           rawSize == block.rawSize;
+#else
+    (void)data;
+    (void)block;
+    (void)raw;
+    return false;
+#endif
+}
+
+} // namespace
+
+bool isArchive(std::string_view data)
+{
+    return data.size() >= headerSize + footerSize && std::memcmp(data.data(), magic, sizeof(magic)) == 0;
+}
+
+ArchiveWriter::ArchiveWriter(const std::string &fileName, ArchiveOptions opts)
+    : file(fileName, std::ios::binary), options(opts)
+{
+    if (!file.is_open())
+        return;
+
+    std::string header(magic, sizeof(magic));
+    store(header, version);
+    file.write(header.data(), static_cast<std::streamsize>(header.size()));
+    position = headerSize;
+}
+
+void ArchiveWriter::add(std::uint64_t id, const std::vector<Sphere> &spheres)
+{
+    auto ordered = spheres;
+    if (options.order == ArchiveOrder::Morton)
+        mortonSort(ordered);
+
+    ArchiveMember member{};
+    member.id = id;
+    member.nbSpheres = ordered.size();
+    member.quantum = options.quantum;
+    member.order = options.order;
+#ifdef AGG_HAVE_ZLIB
+    member.codec = ArchiveCodec::Zlib;
+#else
+    member.codec = ArchiveCodec::Varint;
+#endif
+
+    const std::size_t blockSize = std::max<std::uint32_t>(1, options.blockSize);
+    const auto nbBlocks = (ordered.size() + blockSize - 1) / blockSize;
+    std::vector<ArchiveBlock> blocks(nbBlocks);
+
+    // Each round compresses one block per thread, then the blocks are written in order
+    const auto nbThreads = Parallel::concurrency();
+    std::vector<std::string> raws(nbThreads), stored(nbThreads);
+    for (std::size_t offset = 0; offset < nbBlocks; offset += nbThreads)
+    {
+        const auto nbRound = static_cast<unsigned int>(std::min<std::size_t>(nbThreads, nbBlocks - offset));
+        Parallel::forChunks(nbRound, nbRound, [&](unsigned int, std::size_t first, std::size_t last) {
+            for (auto c = first; c < last; ++c)
+            {
+                const auto begin = (offset + c) * blockSize;
+                const auto end = std::min(begin + blockSize, ordered.size());
+                encodeBlock(ordered.data() + begin, ordered.data() + end, member.quantum, raws[c]);
+                compressBlock(raws[c], stored[c], member.codec);
+
+                auto &block = blocks[offset + c];
+                block.size = static_cast<std::uint32_t>(stored[c].size());
+                block.rawSize = static_cast<std::uint32_t>(raws[c].size());
+                block.count = static_cast<std::uint32_t>(end - begin);
+            }
+        });
+
+        for (unsigned int c = 0; c < nbRound; ++c)
+        {
+            blocks[offset + c].offset = position;
+            file.write(stored[c].data(), static_cast<std::streamsize>(stored[c].size()));
+            position += stored[c].size();
+        }
+    }
+
+    writeMember(member, blocks);
+}
+
+void ArchiveWriter::addRaw(std::string_view archive, const ArchiveMember &member)
+{
+    std::vector<ArchiveBlock> blocks(member.nbBlocks);
+    for (std::size_t b = 0; b < blocks.size(); ++b)
+    {
+        blocks[b] = loadBlock(archive.data() + member.tableOffset + b * blockBytes);
+    }
+
+    for (auto &block : blocks)
+    {
+        const auto source = block.offset;
+        block.offset = position;
+        file.write(archive.data() + source, block.size);
+        position += block.size;
+    }
+
+    writeMember(member, blocks);
+}
+
+void ArchiveWriter::writeMember(ArchiveMember member, std::vector<ArchiveBlock> &blocks)
+{
+    member.nbBlocks = static_cast<std::uint32_t>(blocks.size());
+    member.tableOffset = position;
+    std::string table{};
+    table.reserve(blocks.size() * blockBytes + memberBytes);
+    for (const auto &block : blocks)
+    {
+        store(table, block);
+    }
+    members.emplace_back(member.id, position + blocks.size() * blockBytes);
+    store(table, member);
+
+    file.write(table.data(), static_cast<std::streamsize>(table.size()));
+    position += table.size();
+}
+
+int ArchiveWriter::close()
+{
+    std::string table{};
+    store(table, static_cast<std::uint64_t>(members.size()));
+    for (const auto &m : members)
+    {
+        store(table, m.first);
+        store(table, m.second);
+    }
+    store(table, position);
+    table.append(magic, sizeof(magic));
+    file.write(table.data(), static_cast<std::streamsize>(table.size()));
+    file.close();
+    return file ? 0 : EXIT_FAILURE;
+}
+
+ArchiveReader::ArchiveReader(const std::string &fileName) : mapped(fileName)
+{
+    const auto view = mapped.view();
+    if (!isArchive(view) || std::memcmp(view.data() + view.size() - sizeof(magic), magic, sizeof(magic)) != 0 ||
+        load<std::uint32_t>(view.data() + sizeof(magic)) != version)
+        return;
+
+    const auto tableOffset = load<std::uint64_t>(view.data() + view.size() - footerSize);
+    // Offsets are compared with the room left after them, a corrupt offset could overflow a sum
+    if (tableOffset > view.size() - footerSize - sizeof(std::uint64_t))
+        return;
+
+    const auto count = load<std::uint64_t>(view.data() + tableOffset);
+    if (count > (view.size() - footerSize - tableOffset) / (2 * sizeof(std::uint64_t)))
+        return;
+
+    for (std::uint64_t i = 0; i < count; ++i)
+    {
+        const auto entry = view.data() + tableOffset + sizeof(std::uint64_t) + i * 2 * sizeof(std::uint64_t);
+        const auto memberOffset = load<std::uint64_t>(entry + sizeof(std::uint64_t));
+        if (memberOffset > tableOffset || tableOffset - memberOffset < memberBytes)
+            return;
+
+        const auto member = loadMember(view.data() + memberOffset);
+        if (member.tableOffset > memberOffset ||
+            member.nbBlocks > (memberOffset - member.tableOffset) / blockBytes || !(member.quantum > 0.0))
+            return;
+
+        for (std::uint32_t b = 0; b < member.nbBlocks; ++b)
+        {
+            const auto blk = block(member, b);
+            if (blk.offset > member.tableOffset || blk.size > member.tableOffset - blk.offset)
+                return;
+        }
+        lstMembers.push_back(member);
+    }
+
+    valid = true;
+}
+
+ArchiveBlock ArchiveReader::block(const ArchiveMember &member, std::uint32_t index) const
+{
+    return loadBlock(mapped.view().data() + member.tableOffset + index * blockBytes);
+}
+
+bool ArchiveReader::readBlock(const ArchiveMember &member, std::uint32_t index, std::vector<Sphere> &spheres) const
+{
+    const auto blk = block(member, index);
+    const char *data = mapped.view().data() + blk.offset;
+
+    if (blk.size == blk.rawSize)
+        return decodeBlock(data, data + blk.size, blk.count, member.quantum, spheres);
+
+    std::string raw{};
+    if (member.codec != ArchiveCodec::Zlib || !uncompressBlock(data, blk, raw))
+        return false;
+
+    return decodeBlock(raw.data(), raw.data() + raw.size(), blk.count, member.quantum, spheres);
+}
+
+bool ArchiveReader::read(const ArchiveMember &member, std::vector<Sphere> &spheres) const
+{
+    std::vector<std::vector<Sphere>> decoded(member.nbBlocks);
+    std::vector<char> status(member.nbBlocks, 0);
+
+    Parallel::forChunks(member.nbBlocks, Parallel::concurrency(),
+                        [&](unsigned int, std::size_t first, std::size_t last) {
+                            for (auto b = first; b < last; ++b)
+                            {
+                                status[b] = readBlock(member, static_cast<std::uint32_t>(b), decoded[b]);
+                            }
+                        });
+
+    if (std::find(status.cbegin(), status.cend(), 0) != status.cend())
+        return false;
+
+    spheres.reserve(spheres.size() + member.nbSpheres);
+    for (const auto &d : decoded)
+    {
+        spheres.insert(spheres.end(), d.cbegin(), d.cend());
+    }
+    return true;
+}
+
+} // namespace Agg::File
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/mapped_file.h"
+
+#include "sphere.h"
+
+namespace Agg::File
+{
+
+// Binary aggregate archive (".aggz"). An archive holds several members (ensemble members), each
+// member is a list of spheres whose coordinates and radii are quantized to a fixed step,
+// delta-encoded as zigzag varints and compressed by independent blocks. The member and block
+// tables are stored at the end of the file so a member or a block can be decoded on its own.
+//
+// File layout, little-endian whatever the host order :
+//   "AGGZ" version
+//   member* : block* block_table member_header
+//   member_table : count {id, member_header_offset}*
+//   member_table_offset "AGGZ"
+
+enum class ArchiveOrder : std::uint32_t
+{
+    Spawn = 0,  // Spheres kept in spawn order
+    Morton = 1, // Spheres after the root sorted along a Morton curve, smaller deltas
+};
+
+enum class ArchiveCodec : std::uint32_t
+{
+    Varint = 0, // Zigzag varints only
+    Zlib = 1,   // Zigzag varints deflated with zlib
+};
+
+struct ArchiveOptions
+{
+    double quantum = 1e-4; // Quantization step of coordinates and radii
+    ArchiveOrder order = ArchiveOrder::Spawn;
+    std::uint32_t blockSize = 4096; // Spheres per block
+};
+
+struct ArchiveBlock
+{
+    std::uint64_t offset{}; // From the beginning of the file
+    std::uint32_t size{};   // Stored bytes
+    std::uint32_t rawSize{};
+    std::uint32_t count{}; // Spheres in this block
+    std::uint32_t reserved{};
+};
+
+struct ArchiveMember
+{
+    std::uint64_t id{};
+    std::uint64_t nbSpheres{};
+    double quantum{};
+    ArchiveOrder order{};
+    ArchiveCodec codec{};
+    std::uint32_t nbBlocks{};
+    std::uint32_t reserved{};
+    std::uint64_t tableOffset{}; // Offset of the ArchiveBlock table
+};
+
+// Quick check on the first bytes of a file
+bool isArchive(std::string_view data);
+
+class ArchiveWriter
+{
+  public:
+    ArchiveWriter(const std::string &fileName, ArchiveOptions opts = {});
+
+    bool is_open() const
+    {
+        return file.is_open();
+    }
+
+    // Encode the spheres as a new member, blocks are compressed in parallel
+    void add(std::uint64_t id, const std::vector<Agg::Object::Sphere<double>> &spheres);
+
+    // Copy an encoded member of another archive without decoding it
+    void addRaw(std::string_view archive, const ArchiveMember &member);
+
+    // Write the member table, returns 0 on success
+    int close();
+
+  private:
+    void writeMember(ArchiveMember member, std::vector<ArchiveBlock> &blocks);
+
+  private:
+    std::ofstream file;
+    ArchiveOptions options;
+    std::uint64_t position = 0;
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> members{};
+};
+
+class ArchiveReader
+{
+  public:
+    explicit ArchiveReader(const std::string &fileName);
+
+    // False when the file cannot be read or is not a valid archive
+    bool is_open() const
+    {
+        return valid;
+    }
+
+    std::string_view data() const
+    {
+        return mapped.view();
+    }
+
+    const std::vector<ArchiveMember> &members() const
+    {
+        return lstMembers;
+    }
+
+    ArchiveBlock block(const ArchiveMember &member, std::uint32_t index) const;
+
+    // Decode a single block and append its spheres, returns false on corrupted data
+    bool readBlock(const ArchiveMember &member, std::uint32_t index,
+                   std::vector<Agg::Object::Sphere<double>> &spheres) const;
+
+    // Decode a whole member, blocks are decoded in parallel
+    bool read(const ArchiveMember &member, std::vector<Agg::Object::Sphere<double>> &spheres) const;
+
+  private:
+    MappedFile mapped;
+    std::vector<ArchiveMember> lstMembers{};
+    bool valid = false;
+};
+
+} // namespace Agg::File
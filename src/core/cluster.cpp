@@ -0,0 +1,440 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include "cluster.h"
+
+#include "common/math_utils.h"
+
+namespace Agg::Cluster
+{
+
+namespace
+{
+
+constexpr int maxGridSize = 64;
+constexpr std::size_t maxLargeClusters = 32;
+constexpr int placementAttempts = 1000;
+
+// Earliest t in [0, length] where |p + t * dir| == reach, infinity when there is none
+inline double sweep(const Vec3d &p, const Vec3d &dir, double reach, double length)
+{
+    const auto c = p.Length2() - reach * reach;
+    if (c <= 0.0)
+        return 0.0;
+
+    const auto b = p.x * dir.x + p.y * dir.y + p.z * dir.z;
+    const auto disc = b * b - c;
+    if (b >= 0.0 || disc < 0.0)
+        return std::numeric_limits<double>::infinity();
+
+    const auto t = -b - std::sqrt(disc);
+    return t <= length ? t : std::numeric_limits<double>::infinity();
+}
+
+// Distance from p to the segment [0, dir * length]
+inline double segmentDistance(const Vec3d &p, const Vec3d &dir, double length)
+{
+    const auto t = std::clamp(p.x * dir.x + p.y * dir.y + p.z * dir.z, 0.0, length);
+    return (p - dir * t).Length();
+}
+
+inline int positiveModulo(int v, int m)
+{
+    const auto r = v % m;
+    return r < 0 ? r + m : r;
+}
+
+} // namespace
+
+Cluster::Cluster(const Sphere &monomer, const Vec3d &origin, double depth)
+    : position(origin), octree({0.0, 0.0, 0.0}, depth), radius(monomer.radius), maxRadius(monomer.radius)
+{
+    const Sphere local{{0.0, 0.0, 0.0}, monomer.radius};
+    objects.push_back(local);
+    octree.insert(local);
+}
+
+Engine::Engine(const Parameters &params) : parameters(params)
+{
+}
+
+Vec3d Engine::minImage(Vec3d v) const
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        v[k] -= parameters.box * std::round(v[k] / parameters.box);
+    }
+    return v;
+}
+
+void Engine::wrap(Vec3d &v) const
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        v[k] -= parameters.box * std::floor(v[k] / parameters.box);
+    }
+}
+
+std::vector<std::uint32_t> &Engine::cell(int x, int y, int z)
+{
+    return grid[(positiveModulo(x, gridSize) * gridSize + positiveModulo(y, gridSize)) * gridSize +
+                positiveModulo(z, gridSize)];
+}
+
+void Engine::attach(std::size_t id)
+{
+    auto &c = *clusters[id];
+    c.large = c.radius > cellSize;
+    if (c.large)
+    {
+        largeClusters.push_back(id);
+        return;
+    }
+
+    for (int k = 0; k < 3; ++k)
+    {
+        c.lower[k] = static_cast<int>(std::floor((c.position[k] - c.radius) / cellSize));
+        c.upper[k] = static_cast<int>(std::floor((c.position[k] + c.radius) / cellSize));
+    }
+    for (int x = c.lower[0]; x <= c.upper[0]; ++x)
+        for (int y = c.lower[1]; y <= c.upper[1]; ++y)
+            for (int z = c.lower[2]; z <= c.upper[2]; ++z)
+                cell(x, y, z).push_back(static_cast<std::uint32_t>(id));
+}
+
+void Engine::detach(std::size_t id)
+{
+    const auto &c = *clusters[id];
+    // Every registration made by attach is still there
+    if (c.large)
+    {
+        const auto it = std::find(largeClusters.begin(), largeClusters.end(), id);
+        assert(it != largeClusters.end());
+        largeClusters.erase(it);
+        return;
+    }
+
+    for (int x = c.lower[0]; x <= c.upper[0]; ++x)
+        for (int y = c.lower[1]; y <= c.upper[1]; ++y)
+            for (int z = c.lower[2]; z <= c.upper[2]; ++z)
+            {
+                auto &lst = cell(x, y, z);
+                auto it = std::find(lst.begin(), lst.end(), static_cast<std::uint32_t>(id));
+                assert(it != lst.end());
+                *it = lst.back();
+                lst.pop_back();
+            }
+}
+
+void Engine::resize(int size)
+{
+    for (const auto id : alive)
+        detach(id);
+
+    gridSize = size;
+    cellSize = parameters.box / gridSize;
+    grid.assign(static_cast<std::size_t>(gridSize) * gridSize * gridSize, {});
+
+    for (const auto id : alive)
+        attach(id);
+}
+
+bool Engine::addMonomer(double radius)
+{
+    if (grid.empty())
+    {
+        resize(std::clamp(static_cast<int>(parameters.box / (4.0 * radius)), 1, maxGridSize));
+        minRadius = radius;
+    }
+    minRadius = std::min(minRadius, radius);
+
+    for (int attempt = 0; attempt < placementAttempts; ++attempt)
+    {
+        Vec3d origin{Math::rand_uniform() * parameters.box, Math::rand_uniform() * parameters.box,
+                     Math::rand_uniform() * parameters.box};
+
+        const Vec3d reach{radius, radius, radius};
+        gather(clusters.size(), origin - reach, origin + reach);
+
+        const auto overlaps = std::any_of(candidates.cbegin(), candidates.cend(), [&](std::size_t other) {
+            const auto &c = *clusters[other];
+            return minImage(c.position - origin).Length() < c.radius + radius;
+        });
+        if (overlaps)
+            continue;
+
+        const auto id = clusters.size();
+        clusters.push_back(std::make_unique<Cluster>(Sphere{{0.0, 0.0, 0.0}, radius}, origin, 2 * parameters.box));
+        slots.push_back(alive.size());
+        alive.push_back(id);
+        stamps.push_back(0);
+        sizes[1] += 1;
+        attach(id);
+        bound(*clusters[id]);
+        return true;
+    }
+
+    return false;
+}
+
+// Collect the clusters whose broad phase registration meets the box [lower, upper]
+void Engine::gather(std::size_t id, const Vec3d &lower, const Vec3d &upper)
+{
+    candidates.clear();
+    if (++currStamp == 0)
+    {
+        std::fill(stamps.begin(), stamps.end(), 0);
+        currStamp = 1;
+    }
+
+    int lo[3], hi[3];
+    std::size_t nbCells = 1;
+    for (int k = 0; k < 3; ++k)
+    {
+        lo[k] = static_cast<int>(std::floor(lower[k] / cellSize));
+        hi[k] = static_cast<int>(std::floor(upper[k] / cellSize));
+        if (hi[k] - lo[k] + 1 >= gridSize)
+        {
+            lo[k] = 0;
+            hi[k] = gridSize - 1;
+        }
+        nbCells *= static_cast<std::size_t>(hi[k] - lo[k] + 1);
+    }
+
+    if (nbCells > alive.size())
+    {
+        for (const auto other : alive)
+            if (other != id)
+                candidates.push_back(other);
+        return;
+    }
+
+    for (int x = lo[0]; x <= hi[0]; ++x)
+        for (int y = lo[1]; y <= hi[1]; ++y)
+            for (int z = lo[2]; z <= hi[2]; ++z)
+                for (const auto other : cell(x, y, z))
+                {
+                    if (other != id && stamps[other] != currStamp)
+                    {
+                        stamps[other] = currStamp;
+                        candidates.push_back(other);
+                    }
+                }
+
+    for (const auto other : largeClusters)
+        if (other != id)
+            candidates.push_back(other);
+}
+
+std::size_t Engine::pick() const
+{
+    // Rejection sampling against the most mobile (smallest) cluster
+    const auto smallest = static_cast<double>(sizes.cbegin()->first);
+    for (;;)
+    {
+        const auto id = alive[std::min(alive.size() - 1, static_cast<std::size_t>(Math::rand_uniform() * alive.size()))];
+        const auto ratio = static_cast<double>(clusters[id]->objects.size()) / smallest;
+        if (ratio == 1.0 || Math::rand_uniform() < std::pow(ratio, parameters.mobility))
+            return id;
+    }
+}
+
+double Engine::contactTime(const Cluster &mover, const Cluster &other, const Vec3d &dir, double length)
+{
+    // Origin of other in the frame of mover
+    const auto offset = minImage(other.position - mover.position);
+    const auto half = length * .5;
+    auto tmin = std::numeric_limits<double>::infinity();
+
+    if (mover.objects.size() <= other.objects.size())
+    {
+        for (const auto &a : mover.objects)
+        {
+            const auto local = a.coord - offset;
+            if (segmentDistance(local * -1.0, dir, length) > other.radius + a.radius)
+                continue;
+
+            found.clear();
+            other.octree.getIntersecting(local + dir * half, half + a.radius, found);
+            for (const auto &b : found)
+                tmin = std::min(tmin, sweep(local - b.coord, dir, a.radius + b.radius, length));
+        }
+    }
+    else
+    {
+        for (const auto &b : other.objects)
+        {
+            const auto local = b.coord + offset;
+            if (segmentDistance(local, dir, length) > mover.radius + b.radius)
+                continue;
+
+            found.clear();
+            mover.octree.getIntersecting(local - dir * half, half + b.radius, found);
+            for (const auto &a : found)
+                tmin = std::min(tmin, sweep(a.coord - local, dir, a.radius + b.radius, length));
+        }
+    }
+
+    return tmin;
+}
+
+void Engine::bound(const Cluster &c)
+{
+    // Two clusters meet through the minimum image of their origins only while the sum of their
+    // radii and of a move is at most half the box, which holds when each one does it by half
+    if (2 * c.radius + getStep() > parameters.box * .5)
+        spanning = true;
+}
+
+bool Engine::step()
+{
+    if (alive.size() < 2 || spanning)
+        return false;
+
+    ++nbMoves;
+    const auto id = pick();
+    auto &mover = *clusters[id];
+
+    const auto dir = Math::rand_point_sphere<double>({0.0, 0.0, 0.0}, 1.0);
+    const auto length = getStep();
+
+    // Broad phase : clusters whose bounding sphere meets the swept bounding sphere
+    const auto end = mover.position + dir * length;
+    Vec3d lower{}, upper{};
+    for (int k = 0; k < 3; ++k)
+    {
+        lower[k] = std::min(mover.position[k], end[k]) - mover.radius;
+        upper[k] = std::max(mover.position[k], end[k]) + mover.radius;
+    }
+    gather(id, lower, upper);
+
+    auto tmin = std::numeric_limits<double>::infinity();
+    std::size_t hit = 0;
+    for (const auto other : candidates)
+    {
+        const auto &c = *clusters[other];
+        if (segmentDistance(minImage(c.position - mover.position), dir, length) > mover.radius + c.radius)
+            continue;
+
+        const auto t = contactTime(mover, c, dir, length);
+        if (t < tmin)
+        {
+            tmin = t;
+            hit = other;
+        }
+    }
+
+    const auto contact = tmin <= length;
+    if (contact && Math::rand_uniform() >= parameters.sticking)
+        return false;
+
+    detach(id);
+    mover.position += dir * (contact ? tmin : length);
+    wrap(mover.position);
+    attach(id);
+
+    if (!contact)
+        return false;
+
+    merge(id, hit);
+
+    // Coarsen the grid as clusters grow so that the large ones stay few
+    if (largeClusters.size() > maxLargeClusters && gridSize > 1)
+        resize(gridSize / 2);
+    return true;
+}
+
+void Engine::merge(std::size_t first, std::size_t second)
+{
+    if (clusters[first]->objects.size() < clusters[second]->objects.size())
+        std::swap(first, second);
+
+    auto &keep = *clusters[first];
+    const auto &gone = *clusters[second];
+
+    detach(first);
+    detach(second);
+
+    // Insert the smallest cluster in the frame and the index of the largest one
+    const auto offset = minImage(gone.position - keep.position);
+    keep.objects.reserve(keep.objects.size() + gone.objects.size());
+    for (const auto &s : gone.objects)
+    {
+        const Sphere moved{s.coord + offset, s.radius};
+        keep.objects.push_back(moved);
+        keep.octree.insert(moved);
+        keep.radius = std::max(keep.radius, moved.coord.Length() + moved.radius);
+        keep.maxRadius = std::max(keep.maxRadius, moved.radius);
+    }
+
+    for (const auto size : {keep.objects.size() - gone.objects.size(), gone.objects.size()})
+    {
+        auto it = sizes.find(size);
+        if (--it->second == 0)
+            sizes.erase(it);
+    }
+    sizes[keep.objects.size()] += 1;
+
+    const auto slot = slots[second];
+    alive[slot] = alive.back();
+    slots[alive[slot]] = slot;
+    alive.pop_back();
+    clusters[second].reset();
+
+    attach(first);
+    bound(keep);
+}
+
+void Engine::run()
+{
+    while (alive.size() > std::max<std::size_t>(1, parameters.target) && !spanning)
+    {
+        step();
+    }
+}
+
+Agg::Aggregate<Sphere> Engine::largest() const
+{
+    const auto it = std::max_element(alive.cbegin(), alive.cend(), [this](std::size_t lhs, std::size_t rhs) {
+        return clusters[lhs]->objects.size() < clusters[rhs]->objects.size();
+    });
+    const auto &c = *clusters[*it];
+
+    const Sphere root{c.position + c.objects.front().coord, c.objects.front().radius};
+    Agg::Aggregate<Sphere> agg{root, 2 * c.radius + c.maxRadius};
+    for (const auto &s : c.objects)
+    {
+        const Sphere moved{c.position + s.coord, s.radius};
+        agg.index(moved);
+        agg.objects.push_back(moved);
+    }
+    return agg;
+}
+
+std::vector<std::size_t> Engine::clusterSizes() const
+{
+    std::vector<std::size_t> result{};
+    for (const auto id : alive)
+    {
+        result.push_back(clusters[id]->objects.size());
+    }
+    return result;
+}
+
+std::vector<Sphere> Engine::spheres() const
+{
+    std::vector<Sphere> result{};
+    for (const auto id : alive)
+    {
+        const auto &c = *clusters[id];
+        for (const auto &s : c.objects)
+        {
+            result.push_back({c.position + s.coord, s.radius});
+        }
+    }
+    return result;
+}
+
+} // namespace Agg::Cluster
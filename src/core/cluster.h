@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "common/octree.h"
+#include "common/vector_math.h"
+
+#include "aggregate.h"
+#include "sphere.h"
+
+namespace Agg::Cluster
+{
+
+using Vec3d = Math::Vec3<double>;
+using Sphere = Agg::Object::Sphere<double>;
+
+// A rigid cluster of spheres, stored in its own frame so that a move is a single translation
+struct Cluster
+{
+    Cluster(const Sphere &monomer, const Vec3d &origin, double depth);
+
+    Vec3d position{};              // Origin of the local frame, wrapped in the box
+    std::vector<Sphere> objects{}; // Local coordinates
+    Octree<Sphere> octree;         // Local frame index
+    double radius{};               // Bounding sphere radius around the origin
+    double maxRadius{};            // Radius of the largest sphere
+
+    // Broad phase registration
+    int lower[3]{};
+    int upper[3]{};
+    bool large = false;
+};
+
+struct Parameters
+{
+    double box = 200.0;      // Side of the periodic box
+    double sticking = 1.0;   // Sticking probability at contact, 1 for DLCA, small for RLCA
+    double step = 0.0;       // Length of a move, the smallest monomer radius when 0
+    double mobility = -0.55; // Cluster mobility as size^mobility, about -1/fractal dimension
+    std::size_t target = 1;  // Stop when that many clusters remain
+};
+
+// Cluster-cluster aggregation in a periodic box. Clusters picked according to their mobility
+// move by a fixed step in a random direction and stick to the first cluster they touch. The broad
+// phase is a uniform grid over cluster bounding spheres (largest clusters are kept apart), the
+// narrow phase sweeps the spheres of the smallest cluster through the octree of the other one.
+// Merging inserts the smallest cluster into the frame and octree of the largest one.
+class Engine
+{
+  public:
+    explicit Engine(const Parameters &params);
+
+    // Place a monomer at a random free position, returns false when no room was found
+    bool addMonomer(double radius);
+
+    // One move attempt, returns true when it ended with a merge
+    bool step();
+
+    // Move clusters until the target number of clusters is reached, or until a cluster spans the box
+    void run();
+
+    // Whether a cluster grew over a quarter of the box in radius. The contacts are only searched
+    // between the nearest images of two clusters, the moves then stop
+    bool spans() const
+    {
+        return spanning;
+    }
+
+    std::size_t size() const
+    {
+        return alive.size();
+    }
+
+    std::uint64_t getMoves() const
+    {
+        return nbMoves;
+    }
+
+    // Length of a move, the precision of the cluster positions
+    double getStep() const
+    {
+        return parameters.step > 0.0 ? parameters.step : minRadius;
+    }
+
+    // Largest cluster in absolute coordinates, its first sphere being the root
+    Agg::Aggregate<Sphere> largest() const;
+
+    // Number of clusters of each size
+    const std::map<std::size_t, std::size_t> &getSizes() const
+    {
+        return sizes;
+    }
+
+    // Number of spheres of each cluster
+    std::vector<std::size_t> clusterSizes() const;
+
+    // Spheres of every cluster, each cluster around its wrapped position
+    std::vector<Sphere> spheres() const;
+
+  private:
+    Vec3d minImage(Vec3d v) const;
+    void wrap(Vec3d &v) const;
+
+    std::size_t pick() const;
+    void gather(std::size_t id, const Vec3d &lower, const Vec3d &upper);
+    double contactTime(const Cluster &mover, const Cluster &other, const Vec3d &dir, double length);
+    void merge(std::size_t first, std::size_t second);
+    void bound(const Cluster &c);
+
+    void resize(int size);
+    void attach(std::size_t id);
+    void detach(std::size_t id);
+    std::vector<std::uint32_t> &cell(int x, int y, int z);
+
+  private:
+    Parameters parameters;
+
+    std::vector<std::unique_ptr<Cluster>> clusters{};
+    std::vector<std::size_t> alive{};
+    std::vector<std::size_t> slots{};
+    std::map<std::size_t, std::size_t> sizes{}; // Number of clusters of each size
+
+    int gridSize = 1;
+    double cellSize{};
+    std::vector<std::vector<std::uint32_t>> grid{};
+    std::vector<std::size_t> largeClusters{};
+
+    // Scratch buffers reused by every move
+    std::vector<std::uint32_t> stamps{};
+    std::uint32_t currStamp = 0;
+    std::vector<std::size_t> candidates{};
+    std::vector<Sphere> found{};
+
+    double minRadius{};
+    std::uint64_t nbMoves = 0;
+    bool spanning = false;
+};
+
+} // namespace Agg::Cluster
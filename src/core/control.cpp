@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <type_traits>
 #include <vector>
 
 #include "control.h"
@@ -7,95 +13,404 @@
 namespace Agg::Control
 {
 
-Controller::Controller(Sphere core, const double depth, double precision) : agg(core, depth), dt(precision)
+namespace
+{
+
+constexpr int maxRolls = 32;
+constexpr double rollEpsilon = 1e-9;
+
+inline bool same(const Sphere &lhs, const Sphere &rhs)
+{
+    return lhs.coord.x == rhs.coord.x && lhs.coord.y == rhs.coord.y && lhs.coord.z == rhs.coord.z &&
+           lhs.radius == rhs.radius;
+}
+
+// Coefficients of v in the basis (a, b, c), false when the basis is degenerated
+bool decompose(const Vec3d &a, const Vec3d &b, const Vec3d &c, const Vec3d &v, double (&coefs)[3])
+{
+    const auto det = Math::Dot(a, Math::Cross(b, c));
+    if (std::abs(det) < rollEpsilon)
+        return false;
+
+    coefs[0] = Math::Dot(v, Math::Cross(b, c)) / det;
+    coefs[1] = Math::Dot(a, Math::Cross(v, c)) / det;
+    coefs[2] = Math::Dot(a, Math::Cross(b, v)) / det;
+    return true;
+}
+
+// A circular arc center + radius * (u cos(t) + v sin(t)), t in [0, tmax]
+struct Arc
+{
+    Vec3d center{};
+    double radius{};
+    Vec3d u{};
+    Vec3d v{};
+    double tmax{};
+
+    Vec3d at(double t) const
+    {
+        return center + (u * std::cos(t) + v * std::sin(t)) * radius;
+    }
+};
+
+// First angle where a sphere of radius rad moving along the arc touches obstacle, tmax when none
+double firstContact(const Arc &arc, const Sphere &obstacle, double rad)
+{
+    const auto w = arc.center - obstacle.coord;
+    const auto reach = obstacle.radius + rad;
+    const auto alpha = Math::Dot(w, arc.u), beta = Math::Dot(w, arc.v);
+
+    // Already in contact and moving toward the obstacle
+    if ((w + arc.u * arc.radius).Length2() <= reach * reach * (1 + rollEpsilon) && beta < 0)
+        return 0.0;
+
+    const auto gamma = (reach * reach - w.Length2() - arc.radius * arc.radius) / (2 * arc.radius);
+    const auto rho = std::sqrt(alpha * alpha + beta * beta);
+    if (rho < rollEpsilon || std::abs(gamma) > rho)
+        return arc.tmax;
+
+    const auto phi = std::atan2(beta, alpha), delta = std::acos(gamma / rho);
+    auto t = arc.tmax;
+    for (auto root : {phi - delta, phi + delta})
+    {
+        root = std::fmod(root + 4 * M_PI, 2 * M_PI);
+        if (root > rollEpsilon && root < t)
+            t = root;
+    }
+    return t;
+}
+
+// Distance a sphere of radius rad moving from along the unit direction dir travels before touching
+// obstacle, 0 when they already overlap and infinity when it passes by
+double sweepContact(const Vec3d &from, const Vec3d &dir, double rad, const Sphere &obstacle)
+{
+    const auto w = from - obstacle.coord;
+    const auto reach = obstacle.radius + rad;
+    const auto c = w.Length2() - reach * reach;
+    if (c <= 0)
+        return 0.0;
+
+    const auto b = Math::Dot(w, dir);
+    const auto disc = b * b - c;
+    if (b >= 0 || disc < 0)
+        return std::numeric_limits<double>::infinity();
+    return -b - std::sqrt(disc);
+}
+
+} // namespace
+
+
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+BasicController<Traj, Mini, Spawn, Index>::BasicController(Sphere core, const double depth, double precision, Spawn spawner)
+    : agg(core, depth), core(core), dt(precision), spawner(spawner)
 {
     agg.root = core;
-    agg.objects.push_back(core);
-    agg.octree.insert(core);
+    insert(core);
+    directions = Math::fibonacci_sphere(search.pointsLayer);
 }
 
-Sphere Controller::spawn(const Vec3d &coord, double sphere_rad, double expl_rad)
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+void BasicController<Traj, Mini, Spawn, Index>::reset()
 {
-    Sphere sphere{coord, sphere_rad};
+    reset(core);
+}
+
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+void BasicController<Traj, Mini, Spawn, Index>::reset(const Sphere &root)
+{
+    agg.reset();
+    published.reset();
+    neighbors.invalidate();
+    if (spill != nullptr)
+    {
+        spill->clear();
+        buryAt = memoryLimit * 3 / 4;
+    }
+    counters = {};
+    reach = 0.0;
+    maxRadius = 0.0;
+    agg.root = root;
+    insert(root);
+}
+
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+void BasicController<Traj, Mini, Spawn, Index>::setSearch(const SearchSettings &settings)
+{
+    search = settings;
+    search.nbLayer = std::max(1, search.nbLayer);
+    search.pointsLayer = std::max(1, search.pointsLayer);
+    directions = Math::fibonacci_sphere(search.pointsLayer);
+}
 
-    const auto collisionPoint = movToCenter(sphere);
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+int BasicController<Traj, Mini, Spawn, Index>::setMemoryLimit(std::size_t bytes)
+{
+    if (spill != nullptr && spill->size() > 0)
+    {
+        // The spilled spheres come back after the root
+        std::vector<Sphere> spilled(spill->size(), agg.root);
+        if (!spill->read(0, spilled))
+        {
+            std::cerr << "Cannot read the spilled spheres back" << std::endl;
+            return EXIT_FAILURE;
+        }
+        agg.objects.insert(agg.objects.begin() + 1, spilled.cbegin(), spilled.cend());
+        rebuild();
+    }
+    spill.reset();
+    memoryLimit = bytes;
+    if (bytes == 0)
+        return 0;
 
-    sphere = localMin(sphere, collisionPoint, expl_rad);
+    // A quarter of the memory caches the blocks read back, the rest holds the octree
+    spill = std::make_unique<OutOfCore::Spill>(bytes / 4);
+    if (!spill->is_open())
+    {
+        std::cerr << "Cannot create the temporary file of the out-of-core mode" << std::endl;
+        spill.reset();
+        memoryLimit = 0;
+        return EXIT_FAILURE;
+    }
+    buryAt = bytes * 3 / 4;
+    return 0;
+}
+
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+void BasicController<Traj, Mini, Spawn, Index>::bury()
+{
+    // Down to half of the share of the resident spheres, from the deepest blocks. Only they are
+    // scanned and indexed again, a bury costs the resident part and not the whole aggregate
+    const auto resident = agg.objects.size();
+    const auto keep = static_cast<std::size_t>(resident * (memoryLimit * 3.0 / 8) / residentBytes());
+    if (spill->bury(agg.objects, reach, resident - std::min(keep, resident)) > 0)
+    {
+        agg.objects.shrink_to_fit();
+        rebuild();
+    }
 
-    movToCenter(sphere);
+    // The growth front alone may not fit, the next bury waits for it to grow
+    if (residentBytes() > memoryLimit * 3 / 4 && buryAt <= memoryLimit * 3 / 4)
+        std::cerr << "The growing part of the aggregate exceeds the memory limit" << std::endl;
+    buryAt = std::max(memoryLimit * 3 / 4, residentBytes() * 3 / 2);
+}
 
-    agg.octree.insert(sphere);
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+void BasicController<Traj, Mini, Spawn, Index>::rebuild()
+{
+    // The root cube grows with the aggregate as for insert, and the snapshots start a new epoch
+    // with the resident spheres
+    if (!agg.reindex())
+    {
+        std::cerr << "Cannot index the spheres of the aggregate" << std::endl;
+        std::abort();
+    }
+    published.reset();
+    for (const auto &s : agg.objects)
+    {
+        published.push_back(s);
+    }
+    neighbors.invalidate();
+}
+
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+void BasicController<Traj, Mini, Spawn, Index>::insert(const Sphere &sphere)
+{
+    // A sphere left out of the octree would be crossed by the next ones
+    if (!agg.index(sphere))
+    {
+        std::cerr << "Cannot index the sphere at (" << sphere.coord.x << ", " << sphere.coord.y << ", "
+                  << sphere.coord.z << ") of radius " << sphere.radius << std::endl;
+        std::abort();
+    }
     agg.objects.push_back(sphere);
+    published.push_back(sphere);
+    neighbors.invalidate();
+    reach = std::max(reach, sphere.coord.Length());
+    maxRadius = std::max(maxRadius, sphere.radius);
+}
+
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+Sphere BasicController<Traj, Mini, Spawn, Index>::spawn(const Vec3d &coord, double sphere_rad, double expl_rad)
+{
+    Sphere sphere{coord, sphere_rad};
+
+    if constexpr (std::is_same_v<Traj, Policy::Brownian>)
+    {
+        randomWalk(sphere);
+    }
+    else if constexpr (std::is_same_v<Mini, Policy::Rolling>)
+    {
+        movToCenter(sphere);
+
+        roll(sphere);
+    }
+    else
+    {
+        const auto collisionPoint = movToCenter(sphere);
+
+        sphere = localMin(sphere, collisionPoint, expl_rad);
+
+        movToCenter(sphere);
+    }
+
+    insert(sphere);
+    // A reorder would bring the spilled spheres back in the octree
+    if (reorderEvery != 0 && spill == nullptr && agg.objects.size() % reorderEvery == 0)
+        agg.reorder();
+    if (spill != nullptr && residentBytes() > buryAt)
+        bury();
 
     return sphere;
 }
 
-OptionalVec Controller::collision(const Sphere &sphere) const
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+Sphere BasicController<Traj, Mini, Spawn, Index>::spawn(double sphere_rad, double expl_rad)
 {
-    std::vector<Sphere> found{};
+    return spawn(spawner(reach + sphere_rad + maxRadius + 2 * dt), sphere_rad, expl_rad);
+}
 
-    const auto range = (sphere.radius + agg.root.radius + 2 * dt);
-    agg.octree.getNeighbors(sphere.coord, range, found);
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+const NeighborCache &BasicController<Traj, Mini, Spawn, Index>::around(const Vec3d &coord, double radius) const
+{
+    if (!neighbors.covers(coord, radius))
+    {
+        // The skin, as large as the sphere, lasts about radius / dt steps of movToCenter
+        ++counters.lookups;
+        neighbors.center = coord;
+        neighbors.radius = 2 * radius + dt;
+        neighbors.spheres.clear();
+        intersecting(coord, neighbors.radius, neighbors.spheres);
+    }
+    return neighbors;
+}
+
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+void BasicController<Traj, Mini, Spawn, Index>::intersecting(const Vec3d &coord, double radius,
+                                                             std::vector<Sphere> &found) const
+{
+    agg.octree.getIntersecting(coord, radius, found);
+    if (spill != nullptr)
+        spill->intersecting(coord, radius, found);
+}
 
-    for (const auto &neighbor : found)
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+std::optional<Sphere> BasicController<Traj, Mini, Spawn, Index>::nearest(const Vec3d &coord, double maxDist) const
+{
+    auto result = agg.octree.nearest(coord, maxDist);
+    if (spill != nullptr)
     {
-        if (Agg::Object::intersects(neighbor, sphere))
-        {
-            return Agg::Object::intersectionPoint(neighbor, sphere);
-        }
+        auto best = result.has_value() ? Math::Distance(result->coord, coord) - result->radius : maxDist;
+        spill->nearest(coord, best, result);
     }
+    return result;
+}
 
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+OptionalVec BasicController<Traj, Mini, Spawn, Index>::collision(const Sphere &sphere) const
+{
+    // The first sphere touched in the order of the octree, as a direct query would find it
+    for (const auto &other : around(sphere.coord, sphere.radius).spheres)
+    {
+        if (touches(other, sphere.coord, sphere.radius))
+            return Agg::Object::intersectionPoint(other, sphere);
+    }
     return std::nullopt;
 }
 
-Sphere Controller::localMin(const Sphere &sphere, Vec3d from, double explRad) const
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+bool BasicController<Traj, Mini, Spawn, Index>::collides(const Sphere &sphere) const
+{
+    const auto &cached = around(sphere.coord, sphere.radius).spheres;
+    return std::any_of(cached.cbegin(), cached.cend(),
+                       [&sphere](const Sphere &other) { return touches(other, sphere.coord, sphere.radius); });
+}
+
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+Sphere BasicController<Traj, Mini, Spawn, Index>::localMin(const Sphere &sphere, Vec3d from, double explRad) const
 {
-    const auto nbLayer = 30;
-    const auto pointsLayer = 50;
-    const auto localRad = explRad / nbLayer;
+    const auto baseRad = explRad / search.nbLayer;
+    auto localRad = baseRad;
+    const auto budget = search.budget == 0 ? static_cast<std::size_t>(-1) : search.budget;
 
-    auto currDistMin = Agg::Object::distance(sphere, agg.root);
+    // Squared distances to the root, no square root per candidate
+    auto currDistMin = Math::Distance2(sphere.coord, agg.root.coord);
     auto currMin = sphere;
+    std::size_t evaluated = 0;
+    int stalled = 0;
 
-    for (auto i = 0; i < nbLayer; i++)
+    for (auto i = 0; i < search.nbLayer && evaluated < budget; i++)
     {
-        for (auto j = 0; j < pointsLayer; j++)
+        Math::Rotation rotation{};
+        if (candidates == Candidates::Fibonacci)
         {
+            rotation = Math::rand_rotation();
+        }
+
+        // The candidates of the layer lie within localRad of from, one gathering serves them all
+        around(from, sphere.radius + localRad);
 
-            const Sphere potentialSphere{Math::rand_point_sphere(from, localRad), sphere.radius};
-            const auto newDist = Agg::Object::distance(potentialSphere, agg.root);
+        bool improved = false;
+        for (auto j = 0; j < search.pointsLayer && evaluated < budget; j++, evaluated++)
+        {
+            const auto candidate = candidates == Candidates::Fibonacci
+                                       ? from + Math::rotate(rotation, directions[j]) * localRad
+                                       : Math::rand_point_sphere(from, localRad);
+            const Sphere potentialSphere{candidate, sphere.radius};
+            const auto newDist = Math::Distance2(potentialSphere.coord, agg.root.coord);
 
             if (newDist >= currDistMin)
             {
                 continue;
             }
 
-            if (!collision(potentialSphere).has_value())
+            counters.collisions++;
+            if (!collides(potentialSphere))
             {
                 currMin = potentialSphere;
                 currDistMin = newDist;
+                improved = true;
             }
         }
         from = currMin.coord;
+
+        if (improved)
+        {
+            // Grow the step back after a success, pattern search style
+            localRad = std::min(baseRad, localRad / search.shrink);
+            stalled = 0;
+            continue;
+        }
+
+        localRad *= search.shrink;
+        if (search.patience > 0 && ++stalled >= search.patience)
+        {
+            break;
+        }
     }
 
+    counters.spheres++;
+    counters.candidates += evaluated;
     return currMin;
 }
 
-void Controller::putSphere(const Sphere &sphere)
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+bool BasicController<Traj, Mini, Spawn, Index>::putSphere(const Sphere &sphere, double tolerance)
 {
-    if (collision(sphere).has_value())
+    if (collides({sphere.coord, sphere.radius + tolerance}))
     {
-        agg.objects.push_back(sphere);
-        agg.octree.insert(sphere);
+        insert(sphere);
+        return true;
     }
+    return false;
 }
 
-Vec3d Controller::movToCenter(Sphere &sphere)
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+Vec3d BasicController<Traj, Mini, Spawn, Index>::movToCenter(Sphere &sphere)
 {
     for (;;)
     {
         sphere.coord -= Math::sign(sphere.coord) * dt;
+        ++counters.steps;
         const auto collided = collision(sphere);
         if (collided.has_value())
         {
@@ -104,4 +419,305 @@ Vec3d Controller::movToCenter(Sphere &sphere)
     }
 }
 
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+Vec3d BasicController<Traj, Mini, Spawn, Index>::randomWalk(Sphere &sphere)
+{
+    // The walker is (re)launched from a sphere enclosing the aggregate, and is taken back there
+    // analytically when it goes beyond the kill radius
+    const auto launch = std::max(sphere.coord.Length(), reach + maxRadius + sphere.radius + dt);
+    const auto kill = 2 * launch;
+    const auto bound = reach + maxRadius + sphere.radius;
+
+    for (;;)
+    {
+        const auto dist = sphere.coord.Length();
+
+        if (dist > kill)
+        {
+            // Back to the launch sphere with probability launch / dist (first passage), the hit
+            // point following the harmonic measure seen from the walker. Otherwise the walker
+            // escapes and a new one starts uniformly on the launch sphere.
+            if (Math::rand_uniform() < launch / dist)
+            {
+                const auto inv_far = 1 / (dist + launch);
+                const auto s = inv_far + Math::rand_uniform() * (1 / (dist - launch) - inv_far);
+                const auto cos_theta = std::clamp(
+                    (dist * dist + launch * launch - 1 / (s * s)) / (2 * dist * launch), -1.0, 1.0);
+
+                const auto axis = sphere.coord / dist;
+                auto ortho = Math::rand_point_sphere<double>({0.0, 0.0, 0.0}, 1.0);
+                ortho -= axis * (ortho.x * axis.x + ortho.y * axis.y + ortho.z * axis.z);
+                ortho.Normalize();
+
+                sphere.coord = (axis * cos_theta + ortho * std::sqrt(1 - cos_theta * cos_theta)) * launch;
+            }
+            else
+            {
+                sphere.coord = Math::rand_point_sphere<double>({0.0, 0.0, 0.0}, launch);
+            }
+            continue;
+        }
+
+        // Outside of the aggregate bounding sphere the free distance is known without the octree
+        if (dist > bound + dt)
+        {
+            sphere.coord = Math::rand_point_sphere(sphere.coord, dist - bound);
+            continue;
+        }
+
+        const auto closest = nearest(sphere.coord, bound + dist);
+        if (!closest.has_value())
+        {
+            sphere.coord = Math::rand_point_sphere(sphere.coord, std::max(dt, bound + dt - dist));
+            continue;
+        }
+
+        const auto free = Math::Distance(closest->coord, sphere.coord) - closest->radius - sphere.radius;
+        if (free < dt)
+        {
+            // Stick in contact with the closest sphere
+            auto normal = sphere.coord - closest->coord;
+            normal.Normalize();
+            sphere.coord = closest->coord + normal * (closest->radius + sphere.radius);
+            return closest->coord + normal * closest->radius;
+        }
+
+        // Walk-on-spheres : the first exit of a free ball is uniform on its surface
+        sphere.coord = Math::rand_point_sphere(sphere.coord, free);
+    }
+}
+
+template <typename Traj, typename Mini, typename Spawn, typename Index>
+void BasicController<Traj, Mini, Spawn, Index>::roll(Sphere &sphere) const
+{
+    const auto target = agg.root.coord;
+
+    // Start from the exact contact of the last step of movToCenter, taken again from its free origin.
+    // An axis closer to the root than dt flips at each step, both origins are tried for it
+    auto &found = scratch;
+    auto tmin = std::numeric_limits<double>::infinity();
+    const Sphere *first = nullptr;
+    Vec3d from{}, dir{};
+    for (int flips = 0; flips < 8 && first == nullptr; ++flips)
+    {
+        auto step = Math::sign(sphere.coord) * dt;
+        if (step.Length2() == 0.0)
+            break;
+
+        auto valid = true;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (flips & (1 << i))
+            {
+                valid = valid && std::abs(sphere.coord[i]) < dt;
+                step[i] = -step[i];
+            }
+        }
+        if (!valid)
+            continue;
+
+        from = sphere.coord + step;
+        dir = step.Normalized() * -1.0;
+        found.clear();
+        intersecting(from, sphere.radius + step.Length(), found);
+
+        tmin = std::numeric_limits<double>::infinity();
+        for (const auto &other : found)
+        {
+            const auto t = sweepContact(from, dir, sphere.radius, other);
+            if (t < tmin)
+            {
+                tmin = t;
+                first = &other;
+            }
+        }
+        if (tmin <= 0)
+            first = nullptr;
+    }
+
+    std::vector<Sphere> contacts{};
+    if (first != nullptr)
+    {
+        contacts.push_back(*first);
+        sphere.coord = from + dir * tmin;
+    }
+    else
+    {
+        // No free origin, rest on the closest sphere instead
+        const auto closest = nearest(sphere.coord, sphere.radius + maxRadius + dt);
+        if (!closest.has_value())
+            return;
+        contacts.push_back(*closest);
+        sphere.coord = closest->coord + (sphere.coord - closest->coord).Normalized() * (closest->radius + sphere.radius);
+    }
+    counters.spheres++;
+
+    for (auto iter = 0; iter < maxRolls; iter++)
+    {
+        counters.rolls++;
+        const auto pull = target - sphere.coord;
+        if (pull.Length2() < rollEpsilon)
+            return;
+
+        Arc arc{};
+        if (contacts.size() == 1)
+        {
+            // Roll over the contact along the great circle leading toward the target
+            const auto &a = contacts[0];
+            const auto toTarget = target - a.coord;
+            if (toTarget.Length2() < rollEpsilon)
+                return;
+
+            arc.center = a.coord;
+            arc.radius = a.radius + sphere.radius;
+            arc.u = (sphere.coord - a.coord).Normalized();
+            const auto goal = toTarget.Normalized();
+            const auto tangent = goal - arc.u * Math::Dot(goal, arc.u);
+            if (tangent.Length2() < rollEpsilon)
+                return;
+            arc.v = tangent.Normalized();
+            arc.tmax = std::acos(std::clamp(Math::Dot(arc.u, goal), -1.0, 1.0));
+        }
+        else
+        {
+            const auto &a = contacts[0], &b = contacts[1];
+            const auto na = (a.coord - sphere.coord).Normalized(), nb = (b.coord - sphere.coord).Normalized();
+            const auto axis = Math::Cross(na, nb);
+
+            double coefs[3];
+            if (contacts.size() == 3)
+            {
+                const auto nc = (contacts[2].coord - sphere.coord).Normalized();
+                if (!decompose(na, nb, nc, pull, coefs))
+                    return;
+
+                // Resting when the pull lies in the cone of the contact normals
+                const auto worst = std::min_element(coefs, coefs + 3) - coefs;
+                if (coefs[worst] >= 0)
+                    return;
+                contacts.erase(contacts.begin() + worst);
+                continue;
+            }
+
+            if (axis.Length2() < rollEpsilon || !decompose(na, nb, axis.Normalized(), pull, coefs))
+                return;
+            if (coefs[0] < 0 || coefs[1] < 0)
+            {
+                // Pulled away from one of the contacts, keep rolling over the other one
+                contacts.erase(contacts.begin() + (coefs[0] < coefs[1] ? 0 : 1));
+                continue;
+            }
+
+            // Roll along the circle of the positions touching both contacts
+            const auto gap = b.coord - a.coord;
+            const auto dist = gap.Length();
+            const auto n = gap / dist;
+            const auto ra = a.radius + sphere.radius, rb = b.radius + sphere.radius;
+            const auto offset = (dist * dist + ra * ra - rb * rb) / (2 * dist);
+
+            arc.center = a.coord + n * offset;
+            arc.radius = std::sqrt(std::max(0.0, ra * ra - offset * offset));
+            if (arc.radius < rollEpsilon)
+                return;
+
+            const auto toTarget = target - arc.center;
+            const auto inPlane = toTarget - n * Math::Dot(toTarget, n);
+            if (inPlane.Length2() < rollEpsilon)
+                return;
+
+            arc.u = (sphere.coord - arc.center).Normalized();
+            const auto goal = inPlane.Normalized();
+            const auto tangent = goal - arc.u * Math::Dot(goal, arc.u);
+            if (tangent.Length2() < rollEpsilon)
+                return;
+            arc.v = tangent.Normalized();
+            arc.tmax = std::acos(std::clamp(Math::Dot(arc.u, goal), -1.0, 1.0));
+        }
+
+        // First obstacle met along the arc
+        found.clear();
+        intersecting(arc.center, arc.radius + sphere.radius, found);
+
+        tmin = arc.tmax;
+        const Sphere *obstacle = nullptr;
+        for (const auto &other : found)
+        {
+            if (std::any_of(contacts.cbegin(), contacts.cend(), [&other](const Sphere &c) { return same(c, other); }))
+                continue;
+
+            const auto t = firstContact(arc, other, sphere.radius);
+            if (t < tmin)
+            {
+                tmin = t;
+                obstacle = &other;
+            }
+        }
+
+        sphere.coord = arc.at(tmin);
+        if (obstacle == nullptr)
+        {
+            if (contacts.size() == 1)
+                return;
+            continue;
+        }
+        contacts.push_back(*obstacle);
+    }
+}
+
+namespace Policy
+{
+
+Vec3d UniformSpawn::operator()(double rad) const
+{
+    return Math::rand_point_sphere({0.0, 0.0, 0.0}, rad);
+}
+
+Vec3d AngleSpawn::operator()(double rad) const
+{
+    return Math::rand_point_sphere_angle({0.0, 0.0, 0.0}, rad, alpha, beta);
+}
+
+} // namespace Policy
+
+namespace
+{
+
+template <typename C>
+AnyController make(Sphere core, double depth, double precision, const Policy::AngleSpawn &angles)
+{
+    if constexpr (std::is_same_v<typename C::SpawnPolicy, Policy::AngleSpawn>)
+        return AnyController{std::in_place_type<C>, core, depth, precision, angles};
+    else
+        return AnyController{std::in_place_type<C>, core, depth, precision};
+}
+
+using Factory = AnyController (*)(Sphere, double, double, const Policy::AngleSpawn &);
+
+// Indexed by [angles][trajectory][minimizer], Brownian walks stick where they land and do not minimize
+constexpr Factory factories[2][2][2] = {
+    {{make<BasicController<Policy::Ballistic, Policy::Stochastic>>,
+      make<BasicController<Policy::Ballistic, Policy::Rolling>>},
+     {make<BasicController<Policy::Brownian, Policy::Stochastic>>,
+      make<BasicController<Policy::Brownian, Policy::Stochastic>>}},
+    {{make<BasicController<Policy::Ballistic, Policy::Stochastic, Policy::AngleSpawn>>,
+      make<BasicController<Policy::Ballistic, Policy::Rolling, Policy::AngleSpawn>>},
+     {make<BasicController<Policy::Brownian, Policy::Stochastic, Policy::AngleSpawn>>,
+      make<BasicController<Policy::Brownian, Policy::Stochastic, Policy::AngleSpawn>>}}};
+
+} // namespace
+
+AnyController makeController(Trajectory trajectory, Minimizer minimizer, std::optional<Policy::AngleSpawn> angles,
+                             Sphere core, double depth, double precision)
+{
+    const auto factory = factories[angles.has_value()][trajectory == Trajectory::Brownian][minimizer == Minimizer::Rolling];
+    return factory(core, depth, precision, angles.value_or(Policy::AngleSpawn{}));
+}
+
+template class BasicController<Policy::Ballistic, Policy::Stochastic>;
+template class BasicController<Policy::Ballistic, Policy::Rolling>;
+template class BasicController<Policy::Brownian, Policy::Stochastic>;
+template class BasicController<Policy::Ballistic, Policy::Stochastic, Policy::AngleSpawn>;
+template class BasicController<Policy::Ballistic, Policy::Rolling, Policy::AngleSpawn>;
+template class BasicController<Policy::Brownian, Policy::Stochastic, Policy::AngleSpawn>;
+
 } // namespace Agg::Control
\ No newline at end of file
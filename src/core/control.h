@@ -1,16 +1,22 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <functional>
+#include <variant>
+#include <vector>
 
 #include "aggregate.h"
+#include "out_of_core.h"
 #include "sphere.h"
 
+#include "common/store.h"
 #include "common/vector_math.h"
 
 namespace Agg
 {
-template <typename T>
+template <typename T, typename Index>
 struct Aggregate;
 }
 
@@ -21,36 +27,253 @@ using Vec3d = Math::Vec3<double>;
 using Sphere = Agg::Object::Sphere<double>;
 using OptionalVec = std::optional<Vec3d>;
 
-class Controller
+// Runtime choices of the policies, see makeController
+
+enum class Trajectory
+{
+    Ballistic, // Straight approach to the root, followed by a local minimization
+    Brownian,  // Diffusion limited random walk, accelerated with walk-on-spheres
+};
+
+enum class Candidates
+{
+    Random,    // Independent random points for each candidate
+    Fibonacci, // Fibonacci sphere points, randomly rotated for each layer
+};
+
+enum class Minimizer
+{
+    Stochastic, // Random candidates around the collision point (localMin)
+    Rolling,    // Deterministic rolling over the contact spheres (roll)
+};
+
+// Search performed by localMin : nbLayer layers of pointsLayer candidates around the current
+// minimum, each layer stepping explRad / nbLayer away from it
+struct SearchSettings
+{
+    int nbLayer = 30;
+    int pointsLayer = 50;
+    int patience = 0;       // Stop after that many layers without improvement, 0 to never stop
+    double shrink = 1.0;    // Step factor applied after a layer without improvement
+    std::size_t budget = 0; // Maximum candidates per sphere, 0 for no limit
+};
+
+struct Counters
+{
+    std::uint64_t spheres = 0;    // Spheres minimized
+    std::uint64_t candidates = 0; // Candidates evaluated
+    std::uint64_t collisions = 0; // Collision tests of candidates closer to the root
+    std::uint64_t rolls = 0;      // Rolling steps
+    std::uint64_t steps = 0;      // Straight steps of movToCenter
+    std::uint64_t lookups = 0;    // Octree traversals of the collision tests, the others use the cached neighbors
+};
+
+// Spheres of the aggregate intersecting the sphere (center, radius), in the order of the octree.
+// They answer every collision test of a sphere inside that one: the query is the radius of the
+// tested sphere plus a skin, and lasts until the tested sphere leaves the skin.
+struct NeighborCache
+{
+    Vec3d center{};
+    double radius = -1.0; // Negative when empty
+    std::vector<Sphere> spheres{};
+
+    bool covers(const Vec3d &coord, double rad) const
+    {
+        return Math::Distance(coord, center) + rad <= radius;
+    }
+
+    void invalidate()
+    {
+        radius = -1.0;
+    }
+};
+
+namespace Policy
+{
+
+// Trajectories
+struct Ballistic
+{
+};
+struct Brownian
+{
+};
+
+// Minimizers of the ballistic trajectory
+struct Stochastic
+{
+};
+struct Rolling
+{
+};
+
+// Spawn points on the sphere of radius rad around the origin
+struct UniformSpawn
+{
+    Vec3d operator()(double rad) const;
+};
+
+// Spawn angles following normal laws of deviations alpha (around the z axis) and beta (from the
+// south pole), in degrees
+struct AngleSpawn
+{
+    double alpha = 360.0;
+    double beta = 90.0;
+
+    Vec3d operator()(double rad) const;
+};
+
+} // namespace Policy
+
+// Grows the aggregate sphere by sphere. The trajectory, minimizer, spawn and index policies are
+// template parameters so that each combination compiles into its own specialized loop.
+template <typename Traj, typename Mini, typename Spawn = Policy::UniformSpawn, typename Index = Octree<Sphere>>
+class BasicController
 {
 
 public:
-  Controller(Sphere core, const double depth, double precision = 0.01);
-  ~Controller() = default;
+  using SpawnPolicy = Spawn;
+  using Snapshot = Store<Sphere>::Snapshot;
+
+  BasicController(Sphere core, const double depth, double precision = 0.01, Spawn spawner = {});
+  ~BasicController() = default;
 
   Sphere spawn(const Vec3d &coord, double sphere_rad, double expl_rad);
 
-  void putSphere(const Sphere &sphere);
+  // Spawn from the spawn policy point, far enough not to touch the aggregate
+  Sphere spawn(double sphere_rad, double expl_rad);
+
+  // Start a new aggregate from the construction core alone
+  void reset();
+
+  // Start a new aggregate from root alone, the next reset() starts from the core again
+  void reset(const Sphere &root);
+
+  // Add the sphere if it touches the aggregate within tolerance, returns whether it was added
+  bool putSphere(const Sphere &sphere, double tolerance = 0.0);
 
-  inline Agg::Aggregate<Agg::Object::Sphere<double>> getAggregate() const
+  inline const Agg::Aggregate<Sphere, Index> &getAggregate() const
   {
     return agg;
   }
 
+  // Spheres placed so far, readable from any thread while the growth goes on
+  inline Snapshot snapshot() const
+  {
+    return published.snapshot();
+  }
+
   inline double getPrecision() const
   {
     return dt;
   }
 
+  inline const SearchSettings &getSearch() const
+  {
+    return search;
+  }
+
+  void setSearch(const SearchSettings &settings);
+
+  // Out-of-core mode: keep the octree and the blocks read back within about bytes, the buried
+  // spheres being spilled to a temporary file. 0 keeps everything in memory. Returns 0 on success
+  int setMemoryLimit(std::size_t bytes);
+
+  // Spilled spheres, null when everything is in memory. They are no longer in agg.objects nor in
+  // the snapshots, which hold the resident spheres only
+  inline const OutOfCore::Spill *getSpill() const
+  {
+    return spill.get();
+  }
+
+  // Memory of the resident spheres: the octree, agg.objects and the snapshot store
+  inline std::size_t residentBytes() const
+  {
+    return agg.indexBytes() + 2 * agg.objects.capacity() * sizeof(Sphere);
+  }
+
+  inline const Counters &getCounters() const
+  {
+    return counters;
+  }
+
+  // Largest distance from the origin to a sphere center
+  inline double getReach() const
+  {
+    return reach;
+  }
+
+  // Radius of the largest sphere of the aggregate
+  inline double getMaxRadius() const
+  {
+    return maxRadius;
+  }
+
   // private:
   Vec3d movToCenter(Sphere &obj);
 
+  Vec3d randomWalk(Sphere &obj);
+
   OptionalVec collision(const Sphere &obj) const;
 
+  // Whether the sphere intersects the aggregate, without computing where
+  bool collides(const Sphere &obj) const;
+
+  // Cached neighbors covering the sphere (coord, radius), gathered again when it leaves them
+  const NeighborCache &around(const Vec3d &coord, double radius) const;
+
+  // Queries of the octree, completed by the spilled spheres in out-of-core mode
+  void intersecting(const Vec3d &coord, double radius, std::vector<Sphere> &found) const;
+  std::optional<Sphere> nearest(const Vec3d &coord, double maxDist) const;
+
+  // Spill the buried spheres and rebuild the octree from the others
+  void bury();
+
+  // Index and publish agg.objects again
+  void rebuild();
+
   Sphere localMin(const Sphere &sphere, Vec3d from, double explRad) const;
 
-  Agg::Aggregate<Agg::Object::Sphere<double>> agg{};
+  // Roll the sphere over the aggregate toward the root until it rests on its contacts
+  void roll(Sphere &sphere) const;
+
+  void insert(const Sphere &sphere);
+
+  Agg::Aggregate<Sphere, Index> agg;
+  Sphere core;                  // Root of the aggregate after reset(), agg.root may come from a file
   double dt{};
+  Spawn spawner{};
+  Candidates candidates = Candidates::Random;
+  SearchSettings search{};
+  std::vector<Vec3d> directions{};
+  // The const queries write these buffers, the cache and the spill: they are not reentrant and
+  // must run on the thread that spawns. Other threads read the spheres through snapshot()
+  mutable Counters counters{};
+  mutable std::vector<Sphere> scratch{}; // Reused by the queries, they do not allocate once it has grown
+  mutable NeighborCache neighbors{};     // Emptied by each insertion
+  double reach{};
+  double maxRadius{};
+  std::size_t reorderEvery = 0; // Spawns between two Morton reorders of the aggregate, 0 for never
+  Store<Sphere> published{};    // Same spheres as agg.objects in spawn order, for the snapshots
+  std::size_t memoryLimit = 0;  // Bytes of the out-of-core mode, 0 when off
+  std::size_t buryAt = 0;       // Size of the octree starting the next bury
+  std::unique_ptr<OutOfCore::Spill> spill{};
 };
 
+// Default policies
+using Controller = BasicController<Policy::Ballistic, Policy::Stochastic>;
+
+// The instantiations available to runtime choices. The minimizer does not apply to Brownian
+// trajectories.
+using AnyController = std::variant<BasicController<Policy::Ballistic, Policy::Stochastic>,
+                                   BasicController<Policy::Ballistic, Policy::Rolling>,
+                                   BasicController<Policy::Brownian, Policy::Stochastic>,
+                                   BasicController<Policy::Ballistic, Policy::Stochastic, Policy::AngleSpawn>,
+                                   BasicController<Policy::Ballistic, Policy::Rolling, Policy::AngleSpawn>,
+                                   BasicController<Policy::Brownian, Policy::Stochastic, Policy::AngleSpawn>>;
+
+// Instantiation of the runtime choices, with angle spawns when angles are given
+AnyController makeController(Trajectory trajectory, Minimizer minimizer, std::optional<Policy::AngleSpawn> angles,
+                             Sphere core, double depth, double precision = 0.01);
+
 } // namespace Agg::Control
\ No newline at end of file
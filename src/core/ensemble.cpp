@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+
+#include "archive.h"
+#include "ensemble.h"
+
+#include "common/math_utils.h"
+
+namespace Agg::Ensemble
+{
+
+namespace
+{
+
+constexpr const char *statsHeader = "# id seed spheres rg extent";
+
+} // namespace
+
+bool parseShard(const std::string &text, Shard &shard)
+{
+    std::istringstream stream{text};
+    char slash = 0;
+    Shard parsed{};
+    if (!(stream >> parsed.index >> slash >> parsed.count) || slash != '/' || !stream.eof() || parsed.count == 0 ||
+        parsed.index >= parsed.count)
+        return false;
+
+    shard = parsed;
+    return true;
+}
+
+std::vector<std::uint64_t> members(std::uint64_t ensemble, const Shard &shard)
+{
+    std::vector<std::uint64_t> ids{};
+    for (auto id = std::uint64_t{shard.index}; id < ensemble; id += shard.count)
+    {
+        ids.push_back(id);
+    }
+    return ids;
+}
+
+std::uint64_t memberSeed(std::uint64_t seed, std::uint64_t id)
+{
+    return Math::splitmix64(seed ^ Math::splitmix64(id));
+}
+
+MemberStats statistics(const Aggregate<Agg::Object::Sphere<double>> &agg, std::uint64_t id, std::uint64_t seed)
+{
+    MemberStats stats{id, seed, agg.objects.size()};
+    if (agg.objects.empty())
+        return stats;
+
+    Math::Vec3<double> center{};
+    for (const auto &s : agg.objects)
+    {
+        center += s.coord;
+        stats.extent = std::max(stats.extent, (s.coord - agg.root.coord).Length() + s.radius);
+    }
+    center /= static_cast<double>(agg.objects.size());
+
+    for (const auto &s : agg.objects)
+    {
+        stats.rg += (s.coord - center).Length2();
+    }
+    stats.rg = std::sqrt(stats.rg / static_cast<double>(agg.objects.size()));
+    return stats;
+}
+
+int writeStats(const std::string &fileName, const std::vector<MemberStats> &stats)
+{
+    std::ofstream file{fileName};
+    file.precision(std::numeric_limits<double>::max_digits10);
+    file << statsHeader << '\n';
+    for (const auto &s : stats)
+    {
+        file << s.id << ' ' << s.seed << ' ' << s.spheres << ' ' << s.rg << ' ' << s.extent << '\n';
+    }
+
+    file.close();
+    if (!file)
+    {
+        std::cerr << "Cannot write the ensemble stats in " << fileName << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+int readStats(const std::string &fileName, std::vector<MemberStats> &stats)
+{
+    std::ifstream file{fileName};
+    if (!file.is_open())
+    {
+        std::cerr << "Cannot read the ensemble stats in " << fileName << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string line{};
+    for (std::size_t number = 1; std::getline(file, line); ++number)
+    {
+        if (line.empty() || line.front() == '#')
+            continue;
+
+        std::istringstream fields{line};
+        MemberStats s{};
+        if (!(fields >> s.id >> s.seed >> s.spheres >> s.rg >> s.extent))
+        {
+            std::cerr << fileName << ':' << number << ": Bad ensemble stats" << std::endl;
+            return EXIT_FAILURE;
+        }
+        stats.push_back(s);
+    }
+    return 0;
+}
+
+void summary(const std::vector<MemberStats> &stats)
+{
+    if (stats.empty())
+        return;
+
+    const auto n = static_cast<double>(stats.size());
+    auto spheres = 0.0, rg = 0.0, rg2 = 0.0, extent = 0.0;
+    for (const auto &s : stats)
+    {
+        spheres += static_cast<double>(s.spheres);
+        rg += s.rg;
+        rg2 += s.rg * s.rg;
+        extent += s.extent;
+    }
+    const auto deviation = std::sqrt(std::max(0.0, rg2 / n - (rg / n) * (rg / n)));
+
+    std::cout << "Members: " << stats.size() << ", spheres: " << spheres / n << ", radius of gyration: " << rg / n
+              << " +- " << deviation << ", extent: " << extent / n << std::endl;
+}
+
+int merge(const std::string &output, const std::vector<std::string> &inputs)
+{
+    std::vector<std::unique_ptr<Agg::File::ArchiveReader>> readers{};
+    std::vector<std::pair<const Agg::File::ArchiveMember *, std::size_t>> lstMembers{}; // With their reader
+    std::vector<MemberStats> stats{};
+
+    for (const auto &input : inputs)
+    {
+        readers.push_back(std::make_unique<Agg::File::ArchiveReader>(input));
+        if (!readers.back()->is_open())
+        {
+            std::cerr << "Cannot read the ensemble archive " << input << std::endl;
+            return EXIT_FAILURE;
+        }
+        for (const auto &member : readers.back()->members())
+        {
+            lstMembers.emplace_back(&member, readers.size() - 1);
+        }
+        if (readStats(statsFile(input), stats) != 0)
+            return EXIT_FAILURE;
+    }
+
+    const auto byId = [](const auto &lhs, const auto &rhs) { return lhs.first->id < rhs.first->id; };
+    std::sort(lstMembers.begin(), lstMembers.end(), byId);
+    std::sort(stats.begin(), stats.end(), [](const MemberStats &lhs, const MemberStats &rhs) { return lhs.id < rhs.id; });
+
+    const auto duplicate = std::adjacent_find(lstMembers.cbegin(), lstMembers.cend(), [](const auto &lhs, const auto &rhs) {
+        return lhs.first->id == rhs.first->id;
+    });
+    if (duplicate != lstMembers.cend())
+    {
+        std::cerr << "Member " << duplicate->first->id << " is in several shards" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (stats.size() != lstMembers.size() ||
+        !std::equal(stats.cbegin(), stats.cend(), lstMembers.cbegin(),
+                    [](const MemberStats &s, const auto &m) { return s.id == m.first->id; }))
+    {
+        std::cerr << "The ensemble stats do not match the archive members" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Agg::File::ArchiveWriter archive{output};
+    if (!archive.is_open())
+    {
+        std::cerr << "Cannot write the ensemble in " << output << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (const auto &m : lstMembers)
+    {
+        archive.addRaw(readers[m.second]->data(), *m.first);
+    }
+    if (archive.close() != 0)
+    {
+        std::cerr << "Cannot write the ensemble in " << output << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (writeStats(statsFile(output), stats) != 0)
+        return EXIT_FAILURE;
+
+    summary(stats);
+    std::cout << "Ensemble written in : " << output << std::endl;
+    return 0;
+}
+
+} // namespace Agg::Ensemble
\ No newline at end of file
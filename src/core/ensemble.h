@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "aggregate.h"
+#include "sphere.h"
+
+namespace Agg::Ensemble
+{
+
+// Part i of N of an ensemble, it grows the members i, i + N, i + 2N...
+struct Shard
+{
+    unsigned int index = 0;
+    unsigned int count = 1;
+};
+
+// Parse "i/N" with i < N, returns false when malformed
+bool parseShard(const std::string &text, Shard &shard);
+
+// Ids of the members of the shard, in increasing order
+std::vector<std::uint64_t> members(std::uint64_t ensemble, const Shard &shard);
+
+// Seed of a member, independent of the sharding
+std::uint64_t memberSeed(std::uint64_t seed, std::uint64_t id);
+
+struct MemberStats
+{
+    std::uint64_t id{};
+    std::uint64_t seed{};
+    std::uint64_t spheres{};
+    double rg{};     // Radius of gyration of the sphere centers
+    double extent{}; // Largest distance from the root center to a sphere surface
+};
+
+MemberStats statistics(const Aggregate<Agg::Object::Sphere<double>> &agg, std::uint64_t id, std::uint64_t seed);
+
+// Stats written next to an ensemble archive
+inline std::string statsFile(const std::string &archive)
+{
+    return archive + ".stats";
+}
+
+// Returns 0 on success
+int writeStats(const std::string &fileName, const std::vector<MemberStats> &stats);
+
+// Returns 0 on success, the malformed line is printed otherwise
+int readStats(const std::string &fileName, std::vector<MemberStats> &stats);
+
+// Print the number of members and the mean and deviation of their statistics
+void summary(const std::vector<MemberStats> &stats);
+
+// Gather the members of shard archives and their stats in output, sorted by member id. The
+// members are copied without being decoded, the result does not depend on the sharding.
+// Returns 0 on success
+int merge(const std::string &output, const std::vector<std::string> &inputs);
+
+} // namespace Agg::Ensemble
\ No newline at end of file
@@ -1,90 +1,433 @@
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstring>
 #include <iostream>
-#include <sstream>
 #include <fstream>
+#include <map>
 #include <vector>
 #include <tuple>
 
 #include "file.h"
 #include "sphere.h"
 
+#include "common/mapped_file.h"
+#include "common/math_utils.h"
+#include "common/parallel.h"
+
 namespace Agg::File
 {
 
-std::vector<std::tuple<unsigned int, double, double>>
-read(const std::string &fileName)
+namespace
 {
-    std::vector<std::tuple<unsigned int, double, double>> spheres_input{};
-    std::ifstream myfile;
-    myfile.open(fileName);
-    if (!myfile.is_open())
+
+constexpr std::size_t writeChunkSize = 1 << 16;
+constexpr std::size_t spilledChunkSize = 1 << 12; // Lines formatted at once from an out-of-core aggregate
+
+// Longest line : an index and four doubles in their shortest round-trip form
+constexpr std::size_t maxLineSize = 20 + 4 * 25 + 5;
+
+template <typename V>
+inline char *formatField(char *out, V value, char separator)
+{
+    out = std::to_chars(out, out + 25, value).ptr;
+    *out = separator;
+    return out + 1;
+}
+
+// Lines of spheres[begin, end), numbered from first
+void formatSpheres(const Agg::Object::Sphere<double> *spheres, std::size_t begin, std::size_t end,
+                   std::string &buffer, std::size_t first = 0)
+{
+    buffer.resize((end - begin) * maxLineSize);
+    char *out = buffer.data();
+    for (auto i = begin; i < end; ++i)
     {
-        std::cerr << "Cannot read spheres input in " << fileName << std::endl;
-        exit(EXIT_FAILURE);
+        const auto &s = spheres[i];
+        out = formatField(out, first + i, ' ');
+        out = formatField(out, s.coord[0], ' ');
+        out = formatField(out, s.coord[1], ' ');
+        out = formatField(out, s.coord[2], ' ');
+        out = formatField(out, s.radius, '\n');
     }
-    unsigned int number = 0;
-    double radius = 0.0, expl_rad = 0.0;
-    std::string input{};
-    while (getline(myfile, input))
+    buffer.resize(static_cast<std::size_t>(out - buffer.data()));
+}
+
+// Position and radius of a point cloud vertex
+using Point = std::array<float, 4>;
+
+std::vector<Point> cloud(const std::vector<Agg::Object::Sphere<double>> &spheres, double lod)
+{
+    std::vector<Point> points{};
+    points.reserve(spheres.size());
+    if (lod <= 0.0 || spheres.empty())
     {
-        std::stringstream iss{input};
-        iss >> number >> radius >> expl_rad;
-        if (number == 0 || radius == 0.0)
+        for (const auto &s : spheres)
         {
-            myfile.close();
-            std::cerr << "Bad input" << std::endl;
-            exit(EXIT_FAILURE);
+            points.push_back({float(s.coord.x), float(s.coord.y), float(s.coord.z), float(s.radius)});
         }
-        spheres_input.push_back(std::make_tuple(number, radius, expl_rad));
+        return points;
+    }
+
+    auto lower = spheres.front().coord, upper = lower;
+    for (const auto &s : spheres)
+    {
+        lower = {std::min(lower.x, s.coord.x), std::min(lower.y, s.coord.y), std::min(lower.z, s.coord.z)};
+        upper = {std::max(upper.x, s.coord.x), std::max(upper.y, s.coord.y), std::max(upper.z, s.coord.z)};
+    }
+    // Cells are indexed on 21 bits per axis
+    const auto extent = std::max({upper.x - lower.x, upper.y - lower.y, upper.z - lower.z});
+    const auto cell = std::max(lod, extent / double(1 << 20));
+
+    // Volume and volume weighted center of each cell, in Morton order
+    std::map<std::uint64_t, std::pair<double, Math::Vec3<double>>> cells{};
+    for (const auto &s : spheres)
+    {
+        const auto index = (s.coord - lower) / cell;
+        auto &c = cells[Math::morton3(std::uint32_t(index.x), std::uint32_t(index.y), std::uint32_t(index.z))];
+        const auto volume = s.radius * s.radius * s.radius;
+        c.first += volume;
+        c.second += s.coord * volume;
+    }
+
+    for (const auto &[key, c] : cells)
+    {
+        const auto center = c.second / c.first;
+        points.push_back({float(center.x), float(center.y), float(center.z), float(std::cbrt(c.first))});
     }
+    return points;
+}
 
+// Legacy VTK binary files are big endian
+void putBigEndian(std::string &buffer, std::uint32_t bits)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        buffer.push_back(static_cast<char>((bits >> shift) & 0xff));
+    }
+}
+
+void putBigEndian(std::string &buffer, float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    putBigEndian(buffer, bits);
+}
+
+// PLY files declare little endian, written byte by byte whatever the host order
+void putLittleEndian(std::string &buffer, float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int shift = 0; shift <= 24; shift += 8)
+    {
+        buffer.push_back(static_cast<char>((bits >> shift) & 0xff));
+    }
+}
+
+int writeBuffer(const std::string &buffer, const std::string &fileName)
+{
+    std::ofstream myfile;
+    myfile.open(fileName, std::ios::binary);
+    if (!myfile.is_open())
+    {
+        std::cerr << "Cannot write the aggregate in " << fileName << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    myfile.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
     myfile.close();
+    if (!myfile)
+    {
+        std::cerr << "Cannot write the aggregate in " << fileName << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::cout << "Log written in : " << fileName << std::endl;
+    return 0;
+}
+
+} // namespace
+
+std::optional<std::vector<SpawnRecipe>> read(const std::string &fileName)
+{
+    const MappedFile myfile{fileName};
+    if (!myfile.is_open())
+    {
+        std::cerr << "Cannot read spheres input in " << fileName << std::endl;
+        return std::nullopt;
+    }
+
+    std::vector<SpawnRecipe> spheres_input{};
+    const auto error = parseSpawn(myfile.view(), spheres_input);
+    if (error.has_value())
+    {
+        std::cerr << fileName << ':' << error->line << ": Bad input, " << error->message << std::endl;
+        return std::nullopt;
+    }
 
     return spheres_input;
 }
 
-int input(Agg::Control::Controller &controller, const std::string &fileName)
+int load(const std::string &fileName, std::vector<Agg::Object::Sphere<double>> &spheres, LoadInfo *info)
+{
+    if (info != nullptr)
+        *info = LoadInfo{};
+
+    const MappedFile myFile{fileName};
+    if (!myFile.is_open())
+    {
+        std::cerr << "Cannot read aggregate input in " << fileName << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (isArchive(myFile.view()))
+    {
+        const ArchiveReader archive{fileName};
+        if (!archive.is_open() || archive.members().empty() || !archive.read(archive.members().front(), spheres))
+        {
+            std::cerr << "Corrupted aggregate archive " << fileName << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (info != nullptr)
+        {
+            info->quantum = archive.members().front().quantum;
+            info->spawnOrder = archive.members().front().order == ArchiveOrder::Spawn;
+        }
+        return 0;
+    }
+
+    const auto error = parseAggregate(myFile.view(), spheres);
+    if (error.has_value())
+    {
+        std::cerr << fileName << ':' << error->line << ": Bad aggregate, " << error->message << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+template <typename Controller>
+int input(Controller &controller, const std::string &fileName)
 {
-    std::ifstream myFile;
-    myFile.open(fileName);
-    if (!myFile)
+    std::vector<Agg::Object::Sphere<double>> spheres{};
+    LoadInfo info{};
+    if (load(fileName, spheres, &info) != 0)
+        return EXIT_FAILURE;
+
+    if (spheres.empty())
     {
         std::cerr << "Empty file !" << std::endl;
-        exit(EXIT_FAILURE);
+        return EXIT_FAILURE;
     }
-    double file_x, file_y, file_z, file_rad, i;
-    myFile >> i >> file_x >> file_y >> file_z >> file_rad;
-    controller.agg.root = Agg::Object::Sphere<double>({file_x, file_y, file_z}, file_rad);
-    while (myFile)
+
+    // Quantized contacts may be off by the rounding of both spheres
+    const auto tolerance = std::sqrt(3.0) * info.quantum;
+
+    // The spheres move toward the origin, the aggregate is translated to put its root there
+    const auto shift = spheres.front().coord;
+    for (auto &s : spheres)
+    {
+        s.coord -= shift;
+    }
+
+    // The file root replaces whatever the controller held, so that a member does not depend on the
+    // aggregates grown before it
+    controller.reset(spheres.front());
+    std::vector<Agg::Object::Sphere<double>> pending(spheres.cbegin() + 1, spheres.cend());
+
+    // Out of spawn order a sphere may only touch spheres coming after it, retry until stable
+    for (auto size = pending.size() + 1; !pending.empty() && pending.size() < size;)
     {
-        myFile >> i >> file_x >> file_y >> file_z >> file_rad;
-        const Agg::Object::Sphere<double> new_sphere{{file_x, file_y, file_z}, file_rad};
-        controller.putSphere(new_sphere);
+        size = pending.size();
+        const auto end = std::remove_if(pending.begin(), pending.end(), [&](const auto &s) {
+            return controller.putSphere(s, tolerance);
+        });
+        pending.erase(end, pending.end());
+        if (info.spawnOrder)
+            break;
     }
-    myFile.close();
     return 0;
-} // namespace Agg::File
+}
+
+template int input(Agg::Control::BasicController<Agg::Control::Policy::Ballistic, Agg::Control::Policy::Stochastic> &,
+                   const std::string &);
+template int input(Agg::Control::BasicController<Agg::Control::Policy::Ballistic, Agg::Control::Policy::Rolling> &,
+                   const std::string &);
+template int input(Agg::Control::BasicController<Agg::Control::Policy::Brownian, Agg::Control::Policy::Stochastic> &,
+                   const std::string &);
+template int input(Agg::Control::BasicController<Agg::Control::Policy::Ballistic, Agg::Control::Policy::Stochastic,
+                                                 Agg::Control::Policy::AngleSpawn> &,
+                   const std::string &);
+template int input(Agg::Control::BasicController<Agg::Control::Policy::Ballistic, Agg::Control::Policy::Rolling,
+                                                 Agg::Control::Policy::AngleSpawn> &,
+                   const std::string &);
+template int input(Agg::Control::BasicController<Agg::Control::Policy::Brownian, Agg::Control::Policy::Stochastic,
+                                                 Agg::Control::Policy::AngleSpawn> &,
+                   const std::string &);
 
 template <>
 int write(const Aggregate<Agg::Object::Sphere<double>> &agg, const std::string &fileName)
 {
     std::ofstream myfile;
-    myfile.open(fileName);
+    myfile.open(fileName, std::ios::binary);
     if (!myfile.is_open())
     {
         std::cerr << "Cannot write the aggregate in " << fileName << std::endl;
         exit(EXIT_FAILURE);
     }
 
-    int i = 0;
-    for (const auto &s : agg.objects)
+    // Each round formats one chunk per thread, then the chunks are written in order
+    const auto nbThreads = Parallel::concurrency();
+    const auto count = agg.objects.size();
+    std::vector<std::string> buffers(nbThreads);
+
+    for (std::size_t offset = 0; offset < count; offset += nbThreads * writeChunkSize)
     {
-        myfile << i << ' ' << s.coord[0] << ' ' << s.coord[1] << ' '
-               << s.coord[2] << ' ' << s.radius << '\n';
-        i += 1;
+        const auto roundSize = std::min(count - offset, nbThreads * writeChunkSize);
+        const auto nbChunks = static_cast<unsigned int>((roundSize + writeChunkSize - 1) / writeChunkSize);
+
+        Parallel::forChunks(nbChunks, nbChunks, [&](unsigned int, std::size_t first, std::size_t last) {
+            for (auto c = first; c < last; ++c)
+            {
+                const auto begin = offset + c * writeChunkSize;
+                const auto end = std::min(begin + writeChunkSize, count);
+                formatSpheres(agg.objects.data(), begin, end, buffers[c]);
+            }
+        });
+
+        for (unsigned int c = 0; c < nbChunks; ++c)
+        {
+            myfile.write(buffers[c].data(), static_cast<std::streamsize>(buffers[c].size()));
+        }
     }
+
     myfile.close();
+    if (!myfile)
+    {
+        std::cerr << "Cannot write the aggregate in " << fileName << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::cout << "Log written in : " << fileName << std::endl;
+    return 0;
+}
+
+int write(const Aggregate<Agg::Object::Sphere<double>> &agg, const OutOfCore::Spill &spill,
+          const std::string &fileName)
+{
+    std::ofstream myfile;
+    myfile.open(fileName, std::ios::binary);
+    if (!myfile.is_open())
+    {
+        std::cerr << "Cannot write the aggregate in " << fileName << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // A chunk at a time, the spilled spheres do not come back in memory together
+    std::string buffer{};
+    std::vector<Agg::Object::Sphere<double>> chunk{};
+    const auto resident = agg.objects.size();
+    formatSpheres(agg.objects.data(), 0, std::min<std::size_t>(resident, 1), buffer);
+    myfile.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    for (std::size_t first = 0; first < spill.size(); first += spilledChunkSize)
+    {
+        chunk.assign(std::min(spill.size() - first, spilledChunkSize), agg.root);
+        if (!spill.read(first, chunk))
+        {
+            std::cerr << "Cannot read the spilled spheres back for " << fileName << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        formatSpheres(chunk.data(), 0, chunk.size(), buffer, 1 + first);
+        myfile.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    }
+    for (std::size_t first = 1; first < resident; first += spilledChunkSize)
+    {
+        formatSpheres(agg.objects.data(), first, std::min(first + spilledChunkSize, resident), buffer,
+                      spill.size());
+        myfile.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    }
+
+    myfile.close();
+    if (!myfile)
+    {
+        std::cerr << "Cannot write the aggregate in " << fileName << std::endl;
+        exit(EXIT_FAILURE);
+    }
     std::cout << "Log written in : " << fileName << std::endl;
     return 0;
 }
 
+template <>
+int writeArchive(const Aggregate<Agg::Object::Sphere<double>> &agg, const std::string &fileName,
+                 const ArchiveOptions &options)
+{
+    ArchiveWriter archive{fileName, options};
+    if (!archive.is_open())
+    {
+        std::cerr << "Cannot write the aggregate in " << fileName << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    archive.add(0, agg.objects);
+    if (archive.close() != 0)
+    {
+        std::cerr << "Cannot write the aggregate in " << fileName << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::cout << "Log written in : " << fileName << std::endl;
+    return 0;
+}
+
+template <>
+int writePly(const Aggregate<Agg::Object::Sphere<double>> &agg, const std::string &fileName, double lod)
+{
+    const auto points = cloud(agg.objects, lod);
+
+    std::string buffer = "ply\nformat binary_little_endian 1.0\nelement vertex " + std::to_string(points.size()) +
+                         "\nproperty float x\nproperty float y\nproperty float z\nproperty float radius\n"
+                         "end_header\n";
+    buffer.reserve(buffer.size() + points.size() * sizeof(Point));
+    for (const auto &p : points)
+    {
+        for (const auto value : p)
+        {
+            putLittleEndian(buffer, value);
+        }
+    }
+
+    return writeBuffer(buffer, fileName);
+}
+
+template <>
+int writeVtk(const Aggregate<Agg::Object::Sphere<double>> &agg, const std::string &fileName, double lod)
+{
+    const auto points = cloud(agg.objects, lod);
+    const auto count = std::to_string(points.size());
+
+    std::string buffer = "# vtk DataFile Version 3.0\nAggregate\nBINARY\nDATASET POLYDATA\nPOINTS " + count + " float\n";
+    buffer.reserve(buffer.size() + points.size() * 24 + 128);
+    for (const auto &p : points)
+    {
+        putBigEndian(buffer, p[0]);
+        putBigEndian(buffer, p[1]);
+        putBigEndian(buffer, p[2]);
+    }
+
+    // One vertex cell per point, so that the points are rendered without a filter
+    buffer += "\nVERTICES " + count + ' ' + std::to_string(2 * points.size()) + '\n';
+    for (std::uint32_t i = 0; i < points.size(); ++i)
+    {
+        putBigEndian(buffer, std::uint32_t{1});
+        putBigEndian(buffer, i);
+    }
+
+    buffer += "\nPOINT_DATA " + count + "\nSCALARS radius float 1\nLOOKUP_TABLE default\n";
+    for (const auto &p : points)
+    {
+        putBigEndian(buffer, p[3]);
+    }
+    buffer += '\n';
+
+    return writeBuffer(buffer, fileName);
+}
+
 } // namespace Agg::File
\ No newline at end of file
@@ -2,9 +2,12 @@
 
 #include <string>
 #include <fstream>
+#include <optional>
 
 #include "aggregate.h"
+#include "archive.h"
 #include "control.h"
+#include "parser.h"
 
 namespace Agg::File
 {
@@ -12,9 +15,39 @@ namespace Agg::File
 template <typename T>
 int write(const Aggregate<T> &agg, const std::string &fileName);
 
-int input(Agg::Control::Controller &controller, const std::string &fileName);
+// Text output of an aggregate partly spilled out of core, streamed from the temporary file: the
+// root, the spilled spheres in the order they were buried, then the other resident ones
+int write(const Aggregate<Agg::Object::Sphere<double>> &agg, const OutOfCore::Spill &spill,
+          const std::string &fileName);
 
-std::vector<std::tuple<unsigned int, double, double>>
-read(const std::string &fileName);
+template <typename T>
+int writeArchive(const Aggregate<T> &agg, const std::string &fileName, const ArchiveOptions &options);
+
+// Binary point clouds of the sphere centers with a radius attribute, to be rendered with glyphs
+// (ParaView...). With lod > 0 the spheres of each cubic cell of side lod are merged into one
+// sphere of the same volume at their center of volume.
+template <typename T>
+int writePly(const Aggregate<T> &agg, const std::string &fileName, double lod = 0.0);
+
+template <typename T>
+int writeVtk(const Aggregate<T> &agg, const std::string &fileName, double lod = 0.0);
+
+struct LoadInfo
+{
+    double quantum = 0.0;  // Quantization step, 0.0 for text files
+    bool spawnOrder = true; // Whether every sphere touches one of the previous ones
+};
+
+// Load the spheres of a text aggregate or of the first member of an archive, returns 0 on success
+int load(const std::string &fileName, std::vector<Agg::Object::Sphere<double>> &spheres,
+         LoadInfo *info = nullptr);
+
+// Returns 0 on success, the parse error and its line are printed otherwise. Instantiated for the
+// controllers of Agg::Control::AnyController
+template <typename Controller>
+int input(Controller &controller, const std::string &fileName);
+
+// Returns std::nullopt when the file cannot be read or is malformed
+std::optional<std::vector<SpawnRecipe>> read(const std::string &fileName);
 
 } // namespace Agg::File
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include "out_of_core.h"
+
+namespace Agg::OutOfCore
+{
+
+namespace
+{
+
+// Cells are stored on 21 bits per axis
+constexpr std::int64_t cellBias = std::int64_t{1} << 20;
+
+// Bytes taken by a cached block of count spheres, with its map and list nodes
+constexpr std::size_t cost(std::size_t count)
+{
+    return count * sizeof(Agg::Object::Sphere<double>) + 128;
+}
+
+} // namespace
+
+Spill::Spill(std::size_t cacheBytes) : file(std::tmpfile()), cacheBytes(cacheBytes)
+{
+}
+
+Spill::~Spill()
+{
+    if (file != nullptr)
+        std::fclose(file);
+}
+
+std::int64_t Spill::cell(double x) const
+{
+    return static_cast<std::int64_t>(std::floor(x / side));
+}
+
+Spill::Key Spill::key(std::int64_t x, std::int64_t y, std::int64_t z)
+{
+    const auto pack = [](std::int64_t c) { return static_cast<Key>(c + cellBias) & ((Key{1} << 21) - 1); };
+    return pack(x) << 42 | pack(y) << 21 | pack(z);
+}
+
+std::size_t Spill::bury(std::vector<Sphere> &objects, double reach, std::size_t wanted)
+{
+    if (file == nullptr || objects.empty())
+        return 0;
+
+    if (side == 0.0)
+    {
+        // A few mean spheres across, a query touches a handful of blocks, and small enough for a
+        // young aggregate to hold buried blocks
+        for (const auto &s : objects)
+        {
+            side += s.radius;
+        }
+        side = std::max(std::min(8 * side / objects.size(), reach / 4), 1e-6);
+        span = std::max(2 * reach, side);
+        directory = std::make_unique<Octree<Entry>>(Vec3d{0.0, 0.0, 0.0}, span);
+    }
+
+    // Spheres of the blocks lying inside the aggregate, the growth goes on beyond them. The root
+    // stays first in memory
+    std::unordered_map<Key, std::vector<std::size_t>> members{};
+    const auto depth = reach - side * (1 + std::sqrt(3.0) / 2);
+    for (std::size_t i = 1; i < objects.size(); ++i)
+    {
+        const auto &c = objects[i].coord;
+        const auto x = cell(c.x), y = cell(c.y), z = cell(c.z);
+        const Vec3d middle{(x + 0.5) * side, (y + 0.5) * side, (z + 0.5) * side};
+        if (middle.Length() < depth)
+            members[key(x, y, z)].push_back(i);
+    }
+
+    std::vector<std::pair<double, Key>> order{};
+    order.reserve(members.size());
+    for (const auto &m : members)
+    {
+        order.emplace_back(objects[m.second.front()].coord.Length(), m.first);
+    }
+    std::sort(order.begin(), order.end());
+
+    std::size_t written = 0;
+    std::vector<char> spilled(objects.size(), 0);
+    std::vector<Sphere> spheres{};
+    for (const auto &o : order)
+    {
+        if (written >= wanted)
+            break;
+
+        const auto &indices = members[o.second];
+        spheres.clear();
+        for (const auto i : indices)
+        {
+            spheres.push_back(objects[i]);
+        }
+        if (std::fseek(file, static_cast<long>(end), SEEK_SET) != 0 ||
+            std::fwrite(spheres.data(), sizeof(Sphere), spheres.size(), file) != spheres.size())
+        {
+            std::cerr << "Cannot write the buried spheres in the temporary file" << std::endl;
+            break;
+        }
+
+        auto &block = blocks[o.second];
+        block.extents.push_back({end, static_cast<std::uint32_t>(spheres.size())});
+        end += spheres.size() * sizeof(Sphere);
+
+        // A cached copy misses the new extent
+        const auto cached = cache.find(o.second);
+        if (cached != cache.end())
+        {
+            cachedBytes -= cost(cached->second.spheres.size());
+            uses.erase(cached->second.use);
+            cache.erase(cached);
+        }
+
+        const auto &c = objects[indices.front()].coord;
+        Entry entry{{(cell(c.x) + 0.5) * side, (cell(c.y) + 0.5) * side, (cell(c.z) + 0.5) * side}, block.radius,
+                    o.second};
+        for (const auto &s : spheres)
+        {
+            block.radius = std::max(block.radius, side * std::sqrt(3.0) / 2 + s.radius);
+        }
+        if (entry.radius == 0.0)
+        {
+            entry.radius = block.radius;
+            // The directory doubles until it holds the block
+            while (!directory->insert(entry))
+                widen();
+        }
+        else if (entry.radius < block.radius)
+        {
+            auto grown = entry;
+            grown.radius = block.radius;
+            directory->update(entry, grown);
+        }
+        extent = std::max(extent, entry.coord.Length() + block.radius);
+
+        for (const auto i : indices)
+        {
+            spilled[i] = 1;
+        }
+        count += indices.size();
+        written += indices.size();
+    }
+    std::fflush(file);
+
+    // The other spheres keep their order
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < objects.size(); ++i)
+    {
+        if (!spilled[i])
+            objects[kept++] = objects[i];
+    }
+    objects.erase(objects.begin() + static_cast<std::ptrdiff_t>(kept), objects.end());
+    return written;
+}
+
+bool Spill::read(std::size_t first, std::vector<Sphere> &spheres) const
+{
+    if (file == nullptr || first + spheres.size() > count)
+        return false;
+    if (spheres.empty())
+        return true;
+    return std::fseek(file, static_cast<long>(first * sizeof(Sphere)), SEEK_SET) == 0 &&
+           std::fread(spheres.data(), sizeof(Sphere), spheres.size(), file) == spheres.size();
+}
+
+void Spill::widen()
+{
+    candidates.clear();
+    directory->getIntersecting({0.0, 0.0, 0.0}, std::numeric_limits<double>::infinity(), candidates);
+    span *= 2;
+    directory = std::make_unique<Octree<Entry>>(Vec3d{0.0, 0.0, 0.0}, span);
+    for (const auto &entry : candidates)
+    {
+        directory->insert(entry);
+    }
+}
+
+void Spill::intersecting(const Vec3d &coord, double radius, std::vector<Sphere> &found)
+{
+    // Most queries of the growth front lie beyond the buried blocks
+    if (count == 0 || coord.Length() - radius > extent)
+        return;
+
+    candidates.clear();
+    directory->getIntersecting(coord, radius, candidates);
+    for (const auto &entry : candidates)
+    {
+        for (const auto &s : load(entry.key))
+        {
+            if (touches(s, coord, radius))
+                found.push_back(s);
+        }
+    }
+}
+
+void Spill::nearest(const Vec3d &coord, double &best, std::optional<Sphere> &result)
+{
+    if (count == 0 || coord.Length() - extent >= best)
+        return;
+
+    const auto scan = [&](Key key) {
+        for (const auto &s : load(key))
+        {
+            const auto dist = Math::Distance(s.coord, coord) - s.radius;
+            if (dist < best)
+            {
+                best = dist;
+                result = s;
+            }
+        }
+    };
+
+    // The block closest to coord bounds the search, then the blocks within that bound, closest first
+    const auto closest = directory->nearest(coord, best);
+    if (!closest)
+        return;
+    scan(closest->key);
+
+    candidates.clear();
+    directory->getIntersecting(coord, best, candidates);
+    std::sort(candidates.begin(), candidates.end(), [&](const Entry &lhs, const Entry &rhs) {
+        return Math::Distance(lhs.coord, coord) - lhs.radius < Math::Distance(rhs.coord, coord) - rhs.radius;
+    });
+    for (const auto &entry : candidates)
+    {
+        if (Math::Distance(entry.coord, coord) - entry.radius >= best)
+            break;
+        if (entry.key != closest->key)
+            scan(entry.key);
+    }
+}
+
+const std::vector<Sphere> &Spill::load(Key block)
+{
+    const auto cached = cache.find(block);
+    if (cached != cache.end())
+    {
+        uses.splice(uses.begin(), uses, cached->second.use);
+        return cached->second.spheres;
+    }
+
+    ++loads;
+    Cached entry{};
+    for (const auto &e : blocks[block].extents)
+    {
+        const auto first = entry.spheres.size();
+        entry.spheres.resize(first + e.count, Sphere{{0.0, 0.0, 0.0}, 0.0});
+        if (std::fseek(file, static_cast<long>(e.offset), SEEK_SET) != 0 ||
+            std::fread(entry.spheres.data() + first, sizeof(Sphere), e.count, file) != e.count)
+        {
+            std::cerr << "Cannot read the buried spheres from the temporary file" << std::endl;
+            entry.spheres.erase(entry.spheres.begin() + static_cast<std::ptrdiff_t>(first), entry.spheres.end());
+        }
+    }
+
+    // Least recently used blocks out, the block being read stays
+    cachedBytes += cost(entry.spheres.size());
+    while (cachedBytes > cacheBytes && !uses.empty())
+    {
+        const auto last = cache.find(uses.back());
+        cachedBytes -= cost(last->second.spheres.size());
+        cache.erase(last);
+        uses.pop_back();
+    }
+
+    uses.push_front(block);
+    entry.use = uses.begin();
+    return cache.emplace(block, std::move(entry)).first->second.spheres;
+}
+
+void Spill::clear()
+{
+    end = 0;
+    side = 0.0;
+    extent = 0.0;
+    count = 0;
+    blocks.clear();
+    directory.reset();
+    cachedBytes = 0;
+    uses.clear();
+    cache.clear();
+}
+
+} // namespace Agg::OutOfCore
\ No newline at end of file
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "sphere.h"
+
+#include "common/octree.h"
+#include "common/vector_math.h"
+
+namespace Agg::OutOfCore
+{
+
+using Vec3d = Math::Vec3<double>;
+using Sphere = Agg::Object::Sphere<double>;
+
+// Spheres of the buried regions of an aggregate, moved out of memory. They are appended to a
+// temporary file by cubic blocks, so that the file is written sequentially, and read back a whole
+// block at a time into a cache of the least recently used blocks. Only a directory of the blocks
+// stays in memory, about a hundred bytes for each.
+class Spill
+{
+  public:
+    // Blocks read back are kept within cacheBytes
+    explicit Spill(std::size_t cacheBytes);
+    ~Spill();
+
+    Spill(const Spill &) = delete;
+    Spill &operator=(const Spill &) = delete;
+
+    bool is_open() const
+    {
+        return file != nullptr;
+    }
+
+    // Move about count spheres of objects to the file, from the blocks closest to the root among
+    // those lying inside the sphere of radius reach. The first sphere, the root, is never moved and
+    // the others keep their order. Returns the number of spheres moved
+    std::size_t bury(std::vector<Sphere> &objects, double reach, std::size_t count);
+
+    // Spilled spheres from first, in the order they were buried, to fill spheres. Returns false
+    // when they cannot be read
+    bool read(std::size_t first, std::vector<Sphere> &spheres) const;
+
+    // Spilled spheres intersecting the sphere (coord, radius), appended to found
+    void intersecting(const Vec3d &coord, double radius, std::vector<Sphere> &found);
+
+    // Spilled sphere whose surface is closer to coord than best, best being lowered to its distance
+    void nearest(const Vec3d &coord, double &best, std::optional<Sphere> &result);
+
+    // Forget every spilled sphere, the file is written again from its start
+    void clear();
+
+    // Spheres spilled
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    // Bytes written in the file
+    std::uint64_t fileBytes() const
+    {
+        return end;
+    }
+
+    // Blocks read back from the file
+    std::uint64_t reads() const
+    {
+        return loads;
+    }
+
+  private:
+    using Key = std::uint64_t;
+
+    // Spheres of a block written at once, a block gets another extent when buried again
+    struct Extent
+    {
+        std::uint64_t offset = 0;
+        std::uint32_t count = 0;
+    };
+
+    struct Block
+    {
+        std::vector<Extent> extents{};
+        double radius = 0.0; // Sphere around the middle of the block holding its spheres
+    };
+
+    // Spilled block in the directory
+    struct Entry
+    {
+        Vec3d coord{};
+        double radius = 0.0;
+        Key key = 0;
+
+        friend bool touches(const Entry &entry, const Vec3d &coord, double radius)
+        {
+            return Math::Distance(entry.coord, coord) <= entry.radius + radius;
+        }
+    };
+
+    struct Cached
+    {
+        std::vector<Sphere> spheres{};
+        std::list<Key>::iterator use{};
+    };
+
+    std::int64_t cell(double x) const;
+    static Key key(std::int64_t x, std::int64_t y, std::int64_t z);
+
+    // Double the side of the directory
+    void widen();
+
+    // Spheres of a block, read when not cached. The reference lasts until the next load
+    const std::vector<Sphere> &load(Key block);
+
+  private:
+    std::FILE *file = nullptr;
+    std::uint64_t end = 0;
+    double side = 0.0;   // Side of the blocks, set by the first bury
+    double extent = 0.0; // Distance from the origin covering the spilled spheres
+    std::size_t count = 0;
+    std::unordered_map<Key, Block> blocks{};
+    std::unique_ptr<Octree<Entry>> directory{}; // Blocks by their middle, for the queries
+    double span = 0.0;                          // Half side of the directory
+    std::vector<Entry> candidates{};
+
+    std::size_t cacheBytes;
+    std::size_t cachedBytes = 0;
+    std::list<Key> uses{}; // Most recently used first
+    std::unordered_map<Key, Cached> cache{};
+    std::uint64_t loads = 0;
+};
+
+} // namespace Agg::OutOfCore
\ No newline at end of file
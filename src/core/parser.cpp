@@ -0,0 +1,231 @@
+#include <charconv>
+#include <cmath>
+#include <vector>
+
+#include "parser.h"
+
+#include "common/parallel.h"
+
+namespace Agg::File
+{
+
+namespace
+{
+
+constexpr std::size_t parallelThreshold = 4 << 20;
+
+class LineCursor
+{
+  public:
+    explicit LineCursor(std::string_view text) : curr(text.data()), end(text.data() + text.size()) {}
+
+    // Move to the next line, returns false at the end of the text
+    bool next(std::string_view &line)
+    {
+        if (curr == end)
+            return false;
+
+        const char *eol = curr;
+        while (eol != end && *eol != '\n')
+            ++eol;
+
+        const char *last = eol;
+        if (last != curr && *(last - 1) == '\r')
+            --last;
+
+        line = std::string_view(curr, static_cast<std::size_t>(last - curr));
+        curr = eol == end ? end : eol + 1;
+        ++number;
+        return true;
+    }
+
+    std::size_t line() const
+    {
+        return number;
+    }
+
+  private:
+    const char *curr;
+    const char *end;
+    std::size_t number = 0;
+};
+
+inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+class FieldReader
+{
+  public:
+    explicit FieldReader(std::string_view line) : curr(line.data()), end(line.data() + line.size()) {}
+
+    bool empty()
+    {
+        skip();
+        return curr == end;
+    }
+
+    template <typename V>
+    bool read(V &value)
+    {
+        skip();
+        if (curr != end && *curr == '+')
+            ++curr;
+        const auto [ptr, ec] = std::from_chars(curr, end, value);
+        if (ec != std::errc() || (ptr != end && !isBlank(*ptr)))
+            return false;
+        curr = ptr;
+        return true;
+    }
+
+  private:
+    void skip()
+    {
+        while (curr != end && isBlank(*curr))
+            ++curr;
+    }
+
+  private:
+    const char *curr;
+    const char *end;
+};
+
+OptionalError parseAggregateChunk(std::string_view text, std::vector<Agg::Object::Sphere<double>> &spheres,
+                                  std::size_t &nbLines)
+{
+    LineCursor cursor{text};
+    std::string_view line{};
+    OptionalError error = std::nullopt;
+
+    while (cursor.next(line))
+    {
+        if (error.has_value())
+            continue;
+
+        FieldReader fields{line};
+        if (fields.empty())
+            continue;
+
+        double id, x, y, z, radius;
+        if (!fields.read(id) || !fields.read(x) || !fields.read(y) || !fields.read(z) ||
+            !fields.read(radius) || !fields.empty())
+        {
+            error = ParseError{cursor.line(), "expected \"id x y z radius\""};
+        }
+        else if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z))
+        {
+            error = ParseError{cursor.line(), "sphere coordinates should be finite"};
+        }
+        else if (!(radius > 0.0) || !std::isfinite(radius))
+        {
+            error = ParseError{cursor.line(), "sphere radius should be positive"};
+        }
+        else
+        {
+            spheres.emplace_back(Math::Vec3<double>{x, y, z}, radius);
+        }
+    }
+
+    nbLines = cursor.line();
+    return error;
+}
+
+} // namespace
+
+OptionalError parseSpawn(std::string_view text, std::vector<SpawnRecipe> &recipes)
+{
+    LineCursor cursor{text};
+    std::string_view line{};
+
+    while (cursor.next(line))
+    {
+        FieldReader fields{line};
+        if (fields.empty())
+            continue;
+
+        unsigned int number = 0;
+        double radius = 0.0, expl_rad = 0.0;
+        if (!fields.read(number) || !fields.read(radius))
+        {
+            return ParseError{cursor.line(), "expected \"number radius [exploration radius]\""};
+        }
+        if (!fields.empty() && !fields.read(expl_rad))
+        {
+            return ParseError{cursor.line(), "bad exploration radius"};
+        }
+        if (!fields.empty())
+        {
+            return ParseError{cursor.line(), "too many columns"};
+        }
+        // NaN fails every comparison, infinities are rejected apart
+        if (number == 0 || !(radius > 0.0) || !std::isfinite(radius) || !(expl_rad >= 0.0) ||
+            !std::isfinite(expl_rad))
+        {
+            return ParseError{cursor.line(), "number and radius should be positive"};
+        }
+
+        recipes.emplace_back(number, radius, expl_rad);
+    }
+
+    return std::nullopt;
+}
+
+OptionalError parseAggregate(std::string_view text, std::vector<Agg::Object::Sphere<double>> &spheres)
+{
+    const auto nbChunks = text.size() < parallelThreshold ? 1u : Parallel::concurrency();
+
+    if (nbChunks == 1)
+    {
+        std::size_t nbLines = 0;
+        return parseAggregateChunk(text, spheres, nbLines);
+    }
+
+    // Cut the text at line boundaries, each chunk starting right after a '\n'
+    std::vector<std::string_view> chunks{};
+    std::size_t begin = 0;
+    for (unsigned int c = 1; c <= nbChunks && begin < text.size(); ++c)
+    {
+        auto end = c == nbChunks ? text.size() : text.size() / nbChunks * c;
+        end = end < begin ? begin : end;
+        while (end < text.size() && text[end - 1] != '\n')
+            ++end;
+        chunks.push_back(text.substr(begin, end - begin));
+        begin = end;
+    }
+
+    std::vector<std::vector<Agg::Object::Sphere<double>>> parsed(chunks.size());
+    std::vector<std::size_t> nbLines(chunks.size(), 0);
+    std::vector<OptionalError> errors(chunks.size());
+
+    Parallel::forChunks(chunks.size(), static_cast<unsigned int>(chunks.size()),
+                        [&](unsigned int, std::size_t first, std::size_t last) {
+                            for (auto c = first; c < last; ++c)
+                            {
+                                parsed[c].reserve(chunks[c].size() / 40);
+                                errors[c] = parseAggregateChunk(chunks[c], parsed[c], nbLines[c]);
+                            }
+                        });
+
+    std::size_t lineOffset = 0, total = spheres.size();
+    for (std::size_t c = 0; c < chunks.size(); ++c)
+    {
+        if (errors[c].has_value())
+        {
+            errors[c]->line += lineOffset;
+            return errors[c];
+        }
+        lineOffset += nbLines[c];
+        total += parsed[c].size();
+    }
+
+    spheres.reserve(total);
+    for (const auto &p : parsed)
+    {
+        spheres.insert(spheres.end(), p.cbegin(), p.cend());
+    }
+
+    return std::nullopt;
+}
+
+} // namespace Agg::File
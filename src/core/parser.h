@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "sphere.h"
+
+namespace Agg::File
+{
+
+// Number of spheres, radius and exploration radius (0.0 when not provided)
+using SpawnRecipe = std::tuple<unsigned int, double, double>;
+
+struct ParseError
+{
+    std::size_t line{};
+    std::string message{};
+};
+
+using OptionalError = std::optional<ParseError>;
+
+// Parse a spawn file (see README), blank lines are ignored
+OptionalError parseSpawn(std::string_view text, std::vector<SpawnRecipe> &recipes);
+
+// Parse an aggregate file "id x y z radius", one sphere per line. Files larger than a few
+// megabytes are split at line boundaries and parsed in parallel.
+OptionalError parseAggregate(std::string_view text, std::vector<Agg::Object::Sphere<double>> &spheres);
+
+} // namespace Agg::File
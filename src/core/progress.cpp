@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "progress.h"
+
+namespace Agg::Progress
+{
+
+namespace
+{
+
+std::string duration(double seconds)
+{
+    const auto s = static_cast<std::uint64_t>(std::max(0.0, std::round(seconds)));
+    std::ostringstream text{};
+    if (s >= 3600)
+        text << s / 3600 << 'h';
+    if (s >= 60)
+        text << (s / 60) % 60 << 'm';
+    text << s % 60 << 's';
+    return text.str();
+}
+
+} // namespace
+
+Reporter::Reporter(std::uint64_t total, double interval, bool verbose, std::string statusFile)
+    : total(total), interval(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval))),
+      verbose(verbose), statusFile(std::move(statusFile)), begin(Clock::now()), next(begin + this->interval),
+      last(begin)
+{
+}
+
+void Reporter::report(Clock::time_point now, std::uint64_t steps, std::uint64_t candidates, double extent)
+{
+    const auto seconds = [](Clock::duration d) { return std::chrono::duration<double>(d).count(); };
+    const auto perSphere = [this](std::uint64_t count) { return member == 0 ? 0.0 : double(count) / member; };
+
+    Status status{placed, total, seconds(now - begin)};
+    const auto since = seconds(now - last);
+    status.rate = since > 0.0 ? (placed - lastPlaced) / since : 0.0;
+    status.steps = perSphere(steps);
+    status.candidates = perSphere(candidates);
+    status.extent = extent;
+    status.eta = status.rate > 0.0 ? (total - placed) / status.rate : 0.0;
+
+    if (verbose)
+        std::cerr << format(status) << std::endl;
+    if (!statusFile.empty())
+        writeStatus(statusFile, status);
+
+    last = now;
+    lastPlaced = placed;
+    next = now + interval;
+}
+
+std::string format(const Status &status)
+{
+    std::ostringstream text{};
+    text.setf(std::ios::fixed);
+    text.precision(1);
+    text << "Progress: " << status.placed << '/' << status.total << " spheres ("
+         << (status.total == 0 ? 100.0 : 100.0 * status.placed / status.total) << "%), " << status.rate
+         << " spheres/s, " << status.steps << " steps and " << status.candidates << " candidates per sphere, extent "
+         << status.extent << ", elapsed " << duration(status.elapsed) << ", ETA " << duration(status.eta);
+    return text.str();
+}
+
+int writeStatus(const std::string &fileName, const Status &status)
+{
+    // Written aside then renamed, a reader never sees half a status
+    const auto temporary = fileName + ".tmp";
+    std::ofstream file{temporary};
+    file << "{\"placed\": " << status.placed << ", \"total\": " << status.total << ", \"elapsed\": " << status.elapsed
+         << ", \"rate\": " << status.rate << ", \"steps\": " << status.steps << ", \"candidates\": "
+         << status.candidates << ", \"extent\": " << status.extent << ", \"eta\": " << status.eta << "}\n";
+    file.close();
+    if (!file || std::rename(temporary.c_str(), fileName.c_str()) != 0)
+    {
+        std::cerr << "Cannot write the status in " << fileName << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+} // namespace Agg::Progress
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "control.h"
+
+namespace Agg::Progress
+{
+
+// State of a run at a report
+struct Status
+{
+    std::uint64_t placed = 0; // Spheres spawned so far, over all the members of an ensemble
+    std::uint64_t total = 0;  // Spheres to spawn
+    double elapsed = 0.0;     // Seconds since the start
+    double rate = 0.0;        // Spheres per second since the previous report
+    double steps = 0.0;       // movToCenter steps per sphere of the current aggregate
+    double candidates = 0.0;  // localMin candidates per sphere of the current aggregate
+    double extent = 0.0;      // Current aggregate extent from the origin
+    double eta = 0.0;         // Seconds left at the current rate
+};
+
+// Periodic progress of the spawn loop, on stderr and in a status file. A tick only compares the
+// clock with the next report time, the counters are read when a report is due.
+class Reporter
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // Report every interval seconds on stderr when verbose, and in statusFile when not empty
+    Reporter(std::uint64_t total, double interval, bool verbose, std::string statusFile);
+
+    bool enabled() const
+    {
+        return verbose || !statusFile.empty();
+    }
+
+    // A new aggregate starts, the means per sphere restart
+    void start()
+    {
+        member = 0;
+    }
+
+    // After each spawn of the controller
+    template <typename Controller>
+    void tick(const Controller &controller)
+    {
+        ++placed;
+        ++member;
+        const auto now = Clock::now();
+        if (now < next && placed != total)
+            return;
+
+        const auto &counters = controller.getCounters();
+        report(now, counters.steps, counters.candidates, controller.getReach() + controller.getMaxRadius());
+    }
+
+  private:
+    void report(Clock::time_point now, std::uint64_t steps, std::uint64_t candidates, double extent);
+
+  private:
+    std::uint64_t total;
+    Clock::duration interval;
+    bool verbose;
+    std::string statusFile;
+
+    Clock::time_point begin;
+    Clock::time_point next;
+    Clock::time_point last;  // Previous report
+    std::uint64_t placed = 0;
+    std::uint64_t member = 0; // Spheres of the current aggregate
+    std::uint64_t lastPlaced = 0;
+};
+
+// One line summary, the ETA as hours, minutes and seconds
+std::string format(const Status &status);
+
+// Status as a single JSON object. Returns 0 on success
+int writeStatus(const std::string &fileName, const Status &status);
+
+} // namespace Agg::Progress
\ No newline at end of file
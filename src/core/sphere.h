@@ -10,8 +10,9 @@ namespace Agg::Object
 using Vec3d = Math::Vec3<double>;
 using OptionalVec = std::optional<Vec3d>;
 
+// Aligned on its own size, a double sphere is one packed Math::Vec4 load (x, y, z, radius)
 template <typename T>
-struct Sphere
+struct alignas(4 * sizeof(T)) Sphere
 {
     Sphere(const Math::Vec3<T> c, T rad) : coord(c), radius(rad){};
 
@@ -33,10 +34,23 @@ OptionalVec intersectionPoint(const T &lhs, const T &rhs);
 template <typename T>
 bool intersects(const T &lhs, const T &rhs);
 
+// Whether the sphere touches the sphere (coord, radius), used by the octree queries
+template <typename T>
+bool touches(const T &sphere, const Vec3d &coord, double radius);
+
 template <>
 inline double distance(const Sphere<double> &lhs, const Sphere<double> &rhs)
 {
-    return (lhs.coord - rhs.coord).Length();
+    return Math::Distance(lhs.coord, rhs.coord);
+}
+
+template <>
+inline bool touches(const Sphere<double> &sphere, const Vec3d &coord, double radius)
+{
+    // (dx, dy, dz, radius sum) in one packed subtraction and product
+    const auto d = Math::Vec4<double>::Load(&sphere.coord.x) - Math::Vec4<double>{coord.x, coord.y, coord.z, -radius};
+    const auto p = d * d;
+    return p.x + p.y + p.z <= p.w;
 }
 
 template <>
@@ -0,0 +1,336 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <variant>
+
+#include "core/control.h"
+#include "core/file.h"
+
+#include "common/math_utils.h"
+
+// Python module "aggregate" : a Controller grows the aggregate in process and exposes its spheres
+// through the buffer protocol, numpy.asarray(controller.spheres) is a (N, 4) view of x, y, z and
+// radius without any copy.
+
+namespace
+{
+
+using Sphere = Agg::Object::Sphere<double>;
+
+static_assert(sizeof(Sphere) == 4 * sizeof(double), "The buffer view expects packed spheres");
+
+// The random numbers are shared by all the controllers, spawns run one at a time
+std::mutex spawnMutex;
+
+struct ControllerObject
+{
+    PyObject_HEAD Agg::Control::AnyController *controller;
+    Py_ssize_t exports; // Buffer views alive, the spheres must not move meanwhile
+    bool busy;          // Spawning without the GIL
+    Agg::Control::Counters started; // Counters when the current spawn began
+};
+
+// Returns false with a Python exception set while another thread spawns, the aggregate is then
+// only readable through its snapshots
+bool idle(ControllerObject *self)
+{
+    if (self->busy)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "The controller is already spawning in another thread");
+        return false;
+    }
+    return true;
+}
+
+// Returns false with a Python exception set when the controller cannot be modified
+bool writable(ControllerObject *self)
+{
+    if (!idle(self))
+        return false;
+    if (self->exports > 0)
+    {
+        PyErr_SetString(PyExc_BufferError, "Release the views of the spheres before growing the aggregate");
+        return false;
+    }
+    return true;
+}
+
+const Agg::Aggregate<Sphere> &aggregate(const ControllerObject *self)
+{
+    return std::visit([](const auto &c) -> const Agg::Aggregate<Sphere> & { return c.agg; }, *self->controller);
+}
+
+PyObject *Controller_new(PyTypeObject *type, PyObject *, PyObject *)
+{
+    auto *self = reinterpret_cast<ControllerObject *>(type->tp_alloc(type, 0));
+    if (self != nullptr)
+        self->controller = new Agg::Control::AnyController{
+            Agg::Control::makeController(Agg::Control::Trajectory::Ballistic, Agg::Control::Minimizer::Stochastic,
+                                         std::nullopt, {{0.0, 0.0, 0.0}, 6.0}, 500.0)};
+    return reinterpret_cast<PyObject *>(self);
+}
+
+int Controller_init(ControllerObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *keywords[] = {"root_radius", "depth",      "precision", "trajectory",
+                                     "minimizer",   "candidates", nullptr};
+    double root_radius = 6.0, depth = 500.0, precision = 0.01;
+    const char *trajectory = "ballistic", *minimizer = "stochastic", *candidates = "random";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|dddsss", const_cast<char **>(keywords), &root_radius, &depth,
+                                     &precision, &trajectory, &minimizer, &candidates))
+        return -1;
+
+    const std::string traj{trajectory}, mini{minimizer}, cand{candidates};
+    if ((traj != "ballistic" && traj != "brownian") || (mini != "stochastic" && mini != "rolling") ||
+        (cand != "random" && cand != "fibonacci"))
+    {
+        PyErr_SetString(PyExc_ValueError, "Unknown trajectory (ballistic, brownian), minimizer (stochastic, "
+                                          "rolling) or candidates (random, fibonacci)");
+        return -1;
+    }
+    if (!writable(self))
+        return -1;
+
+    auto *controller = new Agg::Control::AnyController{Agg::Control::makeController(
+        traj == "brownian" ? Agg::Control::Trajectory::Brownian : Agg::Control::Trajectory::Ballistic,
+        mini == "rolling" ? Agg::Control::Minimizer::Rolling : Agg::Control::Minimizer::Stochastic, std::nullopt,
+        {{0.0, 0.0, 0.0}, root_radius}, depth, precision)};
+    std::visit(
+        [&cand](auto &c) {
+            c.candidates = cand == "fibonacci" ? Agg::Control::Candidates::Fibonacci : Agg::Control::Candidates::Random;
+        },
+        *controller);
+
+    delete self->controller;
+    self->controller = controller;
+    return 0;
+}
+
+void Controller_dealloc(ControllerObject *self)
+{
+    delete self->controller;
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject *>(self));
+}
+
+PyObject *Controller_spawn(ControllerObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *keywords[] = {"count", "radius", "explrad", nullptr};
+    Py_ssize_t count = 0;
+    double radius = 0.0, explrad = 50.0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "nd|d", const_cast<char **>(keywords), &count, &radius, &explrad))
+        return nullptr;
+    if (count < 0 || radius <= 0.0)
+    {
+        PyErr_SetString(PyExc_ValueError, "count must be positive and radius strictly positive");
+        return nullptr;
+    }
+    if (!writable(self))
+        return nullptr;
+
+    // Same spawn sphere as the aggregate binary
+    auto &controller = *self->controller;
+    self->started = std::visit([](const auto &c) { return c.getCounters(); }, controller);
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    {
+        const std::lock_guard<std::mutex> lock{spawnMutex};
+        std::visit(
+            [count, radius, explrad](auto &c) {
+                for (Py_ssize_t i = 0; i < count; ++i)
+                {
+                    c.spawn(radius, explrad);
+                }
+            },
+            controller);
+    }
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+
+    Py_RETURN_NONE;
+}
+
+PyObject *Controller_reset(ControllerObject *self, PyObject *)
+{
+    if (!writable(self))
+        return nullptr;
+    std::visit([](auto &c) { c.reset(); }, *self->controller);
+    Py_RETURN_NONE;
+}
+
+PyObject *Controller_load(ControllerObject *self, PyObject *args)
+{
+    const char *fileName = nullptr;
+    if (!PyArg_ParseTuple(args, "s", &fileName) || !writable(self))
+        return nullptr;
+
+    const auto status = std::visit(
+        [fileName](auto &c) {
+            c.reset();
+            return Agg::File::input(c, fileName);
+        },
+        *self->controller);
+    if (status != 0)
+    {
+        PyErr_Format(PyExc_IOError, "Cannot load the aggregate %s", fileName);
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
+PyObject *Controller_write(ControllerObject *self, PyObject *args)
+{
+    const char *fileName = nullptr;
+    if (!PyArg_ParseTuple(args, "s", &fileName) || !idle(self))
+        return nullptr;
+    Agg::File::write(aggregate(self), fileName);
+    Py_RETURN_NONE;
+}
+
+PyObject *Controller_spheres(ControllerObject *self, void *)
+{
+    return PyMemoryView_FromObject(reinterpret_cast<PyObject *>(self));
+}
+
+PyObject *Controller_reach(ControllerObject *self, void *)
+{
+    if (!idle(self))
+        return nullptr;
+    return PyFloat_FromDouble(std::visit([](const auto &c) { return c.getReach(); }, *self->controller));
+}
+
+PyObject *Controller_counters(ControllerObject *self, void *)
+{
+    // The spawning thread writes the counters, the values before its spawn are given meanwhile
+    const auto counters = self->busy ? self->started
+                                     : std::visit([](const auto &c) { return c.getCounters(); }, *self->controller);
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K}", "spheres", counters.spheres, "candidates", counters.candidates,
+                         "collisions", counters.collisions, "rolls", counters.rolls, "steps", counters.steps,
+                         "lookups", counters.lookups);
+}
+
+// From the snapshot, readable while another thread spawns
+Py_ssize_t Controller_len(ControllerObject *self)
+{
+    return static_cast<Py_ssize_t>(
+        std::visit([](const auto &c) { return c.snapshot().size(); }, *self->controller));
+}
+
+// Read only (N, 4) view of the spheres, the octree would not follow writes
+int Controller_getbuffer(ControllerObject *self, Py_buffer *view, int flags)
+{
+    if (flags & PyBUF_WRITABLE)
+    {
+        PyErr_SetString(PyExc_BufferError, "The spheres are read only");
+        return -1;
+    }
+    if (self->busy)
+    {
+        PyErr_SetString(PyExc_BufferError, "The controller is spawning in another thread");
+        return -1;
+    }
+
+    const auto &objects = aggregate(self).objects;
+    auto *layout = new Py_ssize_t[4]{static_cast<Py_ssize_t>(objects.size()), 4, sizeof(Sphere), sizeof(double)};
+
+    view->buf = const_cast<Sphere *>(objects.data());
+    view->obj = reinterpret_cast<PyObject *>(self);
+    Py_INCREF(self);
+    view->len = static_cast<Py_ssize_t>(objects.size() * sizeof(Sphere));
+    view->readonly = 1;
+    view->itemsize = sizeof(double);
+    view->format = (flags & PyBUF_FORMAT) ? const_cast<char *>("d") : nullptr;
+    view->ndim = 2;
+    view->shape = layout;
+    view->strides = layout + 2;
+    view->suboffsets = nullptr;
+    view->internal = layout;
+
+    self->exports++;
+    return 0;
+}
+
+void Controller_releasebuffer(ControllerObject *self, Py_buffer *view)
+{
+    delete[] static_cast<Py_ssize_t *>(view->internal);
+    self->exports--;
+}
+
+PyObject *seed(PyObject *, PyObject *args)
+{
+    unsigned long long value = 0;
+    if (!PyArg_ParseTuple(args, "K", &value))
+        return nullptr;
+
+    const std::lock_guard<std::mutex> lock{spawnMutex};
+    Math::seed(value);
+    Py_RETURN_NONE;
+}
+
+PyMethodDef controllerMethods[] = {
+    {"spawn", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(Controller_spawn)),
+     METH_VARARGS | METH_KEYWORDS,
+     "spawn(count, radius, explrad=50.0)\nGrow the aggregate by count spheres, the GIL is released meanwhile"},
+    {"reset", reinterpret_cast<PyCFunction>(Controller_reset), METH_NOARGS, "Restart from the root sphere alone"},
+    {"load", reinterpret_cast<PyCFunction>(Controller_load), METH_VARARGS,
+     "load(file)\nRestart from an aggregate file or archive"},
+    {"write", reinterpret_cast<PyCFunction>(Controller_write), METH_VARARGS, "write(file)\nWrite the text output"},
+    {nullptr, nullptr, 0, nullptr}};
+
+PyGetSetDef controllerGetters[] = {
+    {"spheres", reinterpret_cast<getter>(Controller_spheres), nullptr,
+     "Read only (N, 4) memoryview of x, y, z and radius, shared with the aggregate", nullptr},
+    {"reach", reinterpret_cast<getter>(Controller_reach), nullptr,
+     "Largest distance from the origin to a sphere center", nullptr},
+    {"counters", reinterpret_cast<getter>(Controller_counters), nullptr,
+     "Work done by the local minimization, as before the current spawn while one runs",
+     nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}};
+
+PySequenceMethods controllerSequence = {reinterpret_cast<lenfunc>(Controller_len)};
+
+PyBufferProcs controllerBuffer = {reinterpret_cast<getbufferproc>(Controller_getbuffer),
+                                  reinterpret_cast<releasebufferproc>(Controller_releasebuffer)};
+
+PyTypeObject ControllerType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+PyMethodDef moduleMethods[] = {
+    {"seed", seed, METH_VARARGS, "seed(value)\nRestart the random numbers of every controller from a seed"},
+    {nullptr, nullptr, 0, nullptr}};
+
+PyModuleDef moduleDef = {PyModuleDef_HEAD_INIT, "aggregate", "Aggregate growth simulation", -1, moduleMethods};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_aggregate()
+{
+    ControllerType.tp_name = "aggregate.Controller";
+    ControllerType.tp_doc = "Controller(root_radius=6.0, depth=500.0, precision=0.01, trajectory='ballistic', "
+                            "minimizer='stochastic', candidates='random')";
+    ControllerType.tp_basicsize = sizeof(ControllerObject);
+    ControllerType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ControllerType.tp_new = Controller_new;
+    ControllerType.tp_init = reinterpret_cast<initproc>(Controller_init);
+    ControllerType.tp_dealloc = reinterpret_cast<destructor>(Controller_dealloc);
+    ControllerType.tp_methods = controllerMethods;
+    ControllerType.tp_getset = controllerGetters;
+    ControllerType.tp_as_sequence = &controllerSequence;
+    ControllerType.tp_as_buffer = &controllerBuffer;
+    if (PyType_Ready(&ControllerType) < 0)
+        return nullptr;
+
+    auto *module = PyModule_Create(&moduleDef);
+    if (module == nullptr)
+        return nullptr;
+
+    Py_INCREF(&ControllerType);
+    if (PyModule_AddObject(module, "Controller", reinterpret_cast<PyObject *>(&ControllerType)) < 0)
+    {
+        Py_DECREF(&ControllerType);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
\ No newline at end of file
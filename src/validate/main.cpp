@@ -0,0 +1,914 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+#include "core/sphere.h"
+#include "core/analysis.h"
+#include "core/cluster.h"
+#include "core/control.h"
+#include "core/file.h"
+
+#include "common/concurrent_octree.h"
+#include "common/math_utils.h"
+#include "common/octree.h"
+#include "common/parallel.h"
+
+namespace
+{
+
+using Sphere = Agg::Object::Sphere<double>;
+using Vec3d = Math::Vec3<double>;
+
+struct Options
+{
+    unsigned long seed = 1;
+    int rounds = 20;
+    std::size_t size = 2000;
+    double alpha = 0.01;
+    double contact = 0.05;
+};
+
+// Keeps the first failures of a check, and counts all of them
+struct Report
+{
+    std::string name;
+    std::size_t checks = 0;
+    std::size_t failures = 0;
+
+    void check(bool ok, const std::string &what)
+    {
+        ++checks;
+        if (ok)
+            return;
+        if (failures++ < 10)
+            std::cerr << name << ": " << what << std::endl;
+    }
+
+    int summary() const
+    {
+        std::cout << name << ": " << checks << " checks, " << failures << " failures" << std::endl;
+        return failures == 0 ? 0 : 1;
+    }
+};
+
+bool less(const Sphere &lhs, const Sphere &rhs)
+{
+    if (lhs.coord.x != rhs.coord.x)
+        return lhs.coord.x < rhs.coord.x;
+    if (lhs.coord.y != rhs.coord.y)
+        return lhs.coord.y < rhs.coord.y;
+    if (lhs.coord.z != rhs.coord.z)
+        return lhs.coord.z < rhs.coord.z;
+    return lhs.radius < rhs.radius;
+}
+
+bool sameSet(std::vector<Sphere> lhs, std::vector<Sphere> rhs)
+{
+    if (lhs.size() != rhs.size())
+        return false;
+    std::sort(lhs.begin(), lhs.end(), less);
+    std::sort(rhs.begin(), rhs.end(), less);
+    return std::equal(lhs.cbegin(), lhs.cend(), rhs.cbegin(), [](const Sphere &a, const Sphere &b) {
+        return !less(a, b) && !less(b, a);
+    });
+}
+
+// Brute force references of the octree queries
+
+std::vector<Sphere> neighbors(const std::vector<Sphere> &spheres, const Vec3d &coord, double depth)
+{
+    std::vector<Sphere> found{};
+    const Vec3d depth_v{depth, depth, depth};
+    for (const auto &s : spheres)
+    {
+        if (s.coord >= coord - depth_v && s.coord <= coord + depth_v)
+            found.push_back(s);
+    }
+    return found;
+}
+
+std::vector<Sphere> intersecting(const std::vector<Sphere> &spheres, const Vec3d &coord, double radius)
+{
+    std::vector<Sphere> found{};
+    for (const auto &s : spheres)
+    {
+        const auto dist = radius + s.radius;
+        if ((s.coord - coord).Length2() <= dist * dist)
+            found.push_back(s);
+    }
+    return found;
+}
+
+double nearest(const std::vector<Sphere> &spheres, const Vec3d &coord)
+{
+    auto best = std::numeric_limits<double>::infinity();
+    for (const auto &s : spheres)
+    {
+        best = std::min(best, (s.coord - coord).Length() - s.radius);
+    }
+    return best;
+}
+
+// Spheres with mixed radii, a part of them snapped on the cube faces of the first levels
+std::vector<Sphere> fuzzSpheres(std::mt19937_64 &gen, std::size_t count, double depth)
+{
+    std::uniform_real_distribution<double> coord(-depth, depth);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const auto maxRadius = depth * std::pow(10.0, -3.0 * unit(gen));
+
+    std::vector<Sphere> spheres{};
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        Vec3d c{coord(gen), coord(gen), coord(gen)};
+        if (unit(gen) < 0.2)
+        {
+            const auto step = depth / (1 << std::uniform_int_distribution<int>(0, 4)(gen));
+            c.x = std::round(c.x / step) * step;
+            c.z = std::round(c.z / step) * step;
+        }
+        spheres.push_back({c, maxRadius * std::pow(unit(gen), 3.0)});
+    }
+    return spheres;
+}
+
+template <typename Index>
+void checkQueries(Report &report, std::mt19937_64 &gen, const Index &octree, const std::vector<Sphere> &spheres,
+                  double depth)
+{
+    std::uniform_real_distribution<double> coord(-1.2 * depth, 1.2 * depth);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    report.check(octree.size() == spheres.size(), "size " + std::to_string(octree.size()) + " instead of " +
+                                                      std::to_string(spheres.size()));
+
+    std::vector<Sphere> found{};
+    for (int q = 0; q < 50; ++q)
+    {
+        const Vec3d c{coord(gen), coord(gen), coord(gen)};
+        const auto range = depth * 0.2 * unit(gen);
+
+        found.clear();
+        octree.getNeighbors(c, range, found);
+        report.check(sameSet(found, neighbors(spheres, c, range)), "getNeighbors differs from the reference");
+
+        found.clear();
+        octree.getIntersecting(c, range, found);
+        report.check(sameSet(found, intersecting(spheres, c, range)), "getIntersecting differs from the reference");
+
+        const auto expected = nearest(spheres, c);
+        const auto closest = octree.nearest(c, std::numeric_limits<double>::infinity());
+        if (!closest.has_value())
+        {
+            report.check(spheres.empty(), "nearest found nothing");
+            continue;
+        }
+        const auto dist = (closest->coord - c).Length() - closest->radius;
+        report.check(std::abs(dist - expected) <= 1e-12 * depth, "nearest at " + std::to_string(dist) +
+                                                                      " instead of " + std::to_string(expected));
+    }
+}
+
+// Octree queries after insertions, removals and moves against brute force
+int validateIndex(const Options &options)
+{
+    Report report{"index"};
+    std::mt19937_64 gen{options.seed};
+
+    for (int round = 0; round < options.rounds; ++round)
+    {
+        const auto depth = std::pow(10.0, std::uniform_real_distribution<double>(0.0, 3.0)(gen));
+        auto spheres = fuzzSpheres(gen, options.size, depth);
+
+        Octree<Sphere> octree{{0.0, 0.0, 0.0}, depth, std::uniform_int_distribution<int>(1, 16)(gen)};
+        for (const auto &s : spheres)
+        {
+            report.check(octree.insert(s), "insert failed");
+        }
+        checkQueries(report, gen, octree, spheres, depth);
+
+        // The same spheres inserted by several threads at once
+        ConcurrentOctree<Sphere> concurrent{{0.0, 0.0, 0.0}, depth, std::uniform_int_distribution<int>(1, 16)(gen)};
+        std::atomic<std::size_t> failed{0};
+        Parallel::forChunks(spheres.size(), std::max(4u, Parallel::concurrency()),
+                            [&](unsigned int, std::size_t first, std::size_t last) {
+                                for (auto i = first; i < last; ++i)
+                                {
+                                    if (!concurrent.insert(spheres[i]))
+                                        failed.fetch_add(1, std::memory_order_relaxed);
+                                }
+                            });
+        report.check(failed.load() == 0, "concurrent insert failed");
+        checkQueries(report, gen, concurrent, spheres, depth);
+
+        // Remove a third of the spheres, move another third
+        std::shuffle(spheres.begin(), spheres.end(), gen);
+        const auto moved = fuzzSpheres(gen, spheres.size() / 3, depth);
+        for (std::size_t i = 0; i < moved.size(); ++i)
+        {
+            report.check(octree.remove(spheres.back()), "remove failed");
+            spheres.pop_back();
+            report.check(octree.update(spheres[i], moved[i]), "update failed");
+            spheres[i] = moved[i];
+        }
+        report.check(!octree.remove({{2 * depth, 0.0, 0.0}, 1.0}), "removed a sphere out of the tree");
+        checkQueries(report, gen, octree, spheres, depth);
+
+        for (const auto &s : spheres)
+        {
+            report.check(octree.remove(s), "remove failed");
+        }
+        checkQueries(report, gen, octree, {}, depth);
+    }
+
+    return report.summary();
+}
+
+// Reference of Controller::movToCenter with brute force collisions
+Vec3d movToCenter(const std::vector<Sphere> &spheres, Sphere sphere, double dt)
+{
+    for (;;)
+    {
+        sphere.coord -= Math::sign(sphere.coord) * dt;
+        if (!intersecting(spheres, sphere.coord, sphere.radius).empty())
+            return sphere.coord;
+    }
+}
+
+// Aggregates grown with every minimizer and trajectory, checked against brute force
+int validateController(const Options &options)
+{
+    Report report{"controller"};
+    Math::seed(options.seed);
+    std::mt19937_64 gen{options.seed};
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    const struct
+    {
+        const char *name;
+        Agg::Control::Trajectory trajectory;
+        Agg::Control::Minimizer minimizer;
+        double overlap; // Largest penetration allowed by the mode, two steps of movToCenter for localMin
+    } modes[] = {
+        {"stochastic", Agg::Control::Trajectory::Ballistic, Agg::Control::Minimizer::Stochastic, 2 * std::sqrt(3.0) * 0.01},
+        {"rolling", Agg::Control::Trajectory::Ballistic, Agg::Control::Minimizer::Rolling, 1e-6},
+        {"dla", Agg::Control::Trajectory::Brownian, Agg::Control::Minimizer::Stochastic, 1e-6},
+    };
+
+    const auto count = std::min<std::size_t>(options.size, 300);
+    std::size_t spilled = 0;
+    for (int round = 0; round < options.rounds; ++round)
+    {
+        const auto &mode = modes[round % 3];
+        const auto outOfCore = round / 3 % 2 == 1;
+        const auto size = outOfCore ? 10 * count : count;
+        const auto spread = 4.0 * unit(gen);
+
+        auto any = Agg::Control::makeController(mode.trajectory, mode.minimizer, std::nullopt,
+                                                {{0.0, 0.0, 0.0}, 1.0 + spread * unit(gen)}, 500.0);
+        std::visit(
+            [&](auto &controller) {
+                controller.setSearch({10, 20});
+                // Every other set of modes grows larger than its memory limit, the spilled spheres
+                // then leave agg.objects and the references keep their own list
+                if (outOfCore)
+                    report.check(controller.setMemoryLimit(512 << 10) == 0, "memory limit refused");
+                std::vector<Sphere> spheres(controller.agg.objects);
+
+                for (std::size_t i = 0; i < size; ++i)
+                {
+                    const auto rad = 0.5 + spread * std::pow(unit(gen), 2.0);
+                    const auto spawnRad = controller.getReach() + rad + controller.getMaxRadius() + 0.02;
+                    const auto added = controller.spawn(Math::rand_point_sphere({0.0, 0.0, 0.0}, spawnRad), rad, 5.0);
+
+                    const auto gap = nearest(spheres, added.coord) - added.radius;
+                    spheres.push_back(added);
+                    report.check(gap >= -mode.overlap, std::string{mode.name} + " sphere overlapping by " + std::to_string(-gap));
+                    if (mode.minimizer == Agg::Control::Minimizer::Rolling || mode.trajectory == Agg::Control::Trajectory::Brownian)
+                        report.check(gap <= 0.01, std::string{mode.name} + " sphere not in contact, gap " + std::to_string(gap));
+                }
+
+                // Collisions and straight approaches of probe spheres
+                const auto reach = controller.getReach() + controller.getMaxRadius();
+                for (int q = 0; q < 20; ++q)
+                {
+                    Sphere probe{Math::rand_point_sphere({0.0, 0.0, 0.0}, reach * unit(gen)), 0.5 + spread * unit(gen)};
+                    report.check(controller.collision(probe).has_value() ==
+                                     !intersecting(spheres, probe.coord, probe.radius).empty(),
+                                 "collision differs from the reference");
+
+                    probe.coord = Math::rand_point_sphere({0.0, 0.0, 0.0}, reach + probe.radius + 0.02);
+                    const auto expected = movToCenter(spheres, probe, controller.getPrecision());
+                    controller.movToCenter(probe);
+                    report.check((probe.coord - expected).Length2() == 0.0, "movToCenter stopped elsewhere than the reference");
+                }
+
+                // The spilled spheres read back complete the resident ones
+                if (const auto *spill = controller.getSpill())
+                {
+                    std::vector<Sphere> found(spill->size(), spheres.front());
+                    report.check(spill->read(0, found), "spilled spheres not read back");
+                    found.insert(found.end(), controller.agg.objects.cbegin(), controller.agg.objects.cend());
+                    auto expected = spheres;
+                    std::sort(found.begin(), found.end(), less);
+                    std::sort(expected.begin(), expected.end(), less);
+                    const auto same = [](const Sphere &a, const Sphere &b) { return !less(a, b) && !less(b, a); };
+                    report.check(std::equal(found.cbegin(), found.cend(), expected.cbegin(), expected.cend(), same),
+                                 "spilled and resident spheres differ from the aggregate");
+                    spilled += spill->size();
+                }
+            },
+            any);
+    }
+    if (options.rounds > 3)
+        report.check(spilled > 0, "no sphere spilled under the memory limit");
+
+    // Large spheres walk the aggregate past the root cube of its octree, which grows to keep them,
+    // in memory then out of core
+    for (const std::size_t limit : {std::size_t{0}, std::size_t{256} << 10})
+    {
+        Agg::Control::BasicController<Agg::Control::Policy::Brownian, Agg::Control::Policy::Stochastic> walker(
+            {{0.0, 0.0, 0.0}, 15.0}, 500.0);
+        report.check(walker.setMemoryLimit(limit) == 0, "memory limit refused");
+        std::vector<Sphere> spheres(walker.agg.objects);
+        double far = 0.0;
+        while (far <= 500.0 && spheres.size() < 10000)
+        {
+            const auto added = walker.spawn(15.0, 5.0);
+            const auto gap = nearest(spheres, added.coord) - added.radius;
+            spheres.push_back(added);
+            report.check(gap >= -1e-6, "sphere beyond the root cube overlapping by " + std::to_string(-gap));
+            far = std::max({far, std::abs(added.coord.x), std::abs(added.coord.y), std::abs(added.coord.z)});
+        }
+        report.check(far > 500.0, "aggregate not grown past the root cube");
+        report.check(walker.agg.octree.size() == walker.agg.objects.size(), "spheres left out of the octree");
+        report.check(walker.agg.octree.depth() > 500.0, "root cube not grown with the aggregate");
+        if (const auto *spill = walker.getSpill())
+        {
+            report.check(spill->size() > 0, "no sphere spilled beyond the root cube");
+            report.check(spill->size() + walker.agg.objects.size() == spheres.size(), "spheres lost out of core");
+        }
+    }
+
+    return report.summary();
+}
+
+// Snapshots taken by another thread while the aggregate grows, checked against the final spheres
+int validateSnapshot(const Options &options)
+{
+    Report report{"snapshot"};
+    Math::seed(options.seed);
+
+    const auto same = [](const Sphere &a, const Sphere &b) { return !less(a, b) && !less(b, a); };
+    const auto matches = [&same](const Agg::Control::Controller::Snapshot &snap, const std::vector<Sphere> &spheres) {
+        if (snap.size() > spheres.size())
+            return false;
+        bool ok = true;
+        std::size_t i = 0;
+        snap.forEach([&](const Sphere &s) { ok = ok && same(s, spheres[i++]); });
+        return ok;
+    };
+
+    const auto count = std::min<std::size_t>(options.size, 1000);
+    Agg::Control::Controller controller({{0.0, 0.0, 0.0}, 1.0}, 500.0);
+    controller.setSearch({5, 10});
+
+    Agg::Control::Controller::Snapshot previous{};
+    std::vector<Sphere> previousSpheres{};
+    for (int round = 0; round < options.rounds; ++round)
+    {
+        controller.reset();
+
+        std::atomic<bool> done{false};
+        std::vector<Agg::Control::Controller::Snapshot> taken{};
+        std::thread reader([&]() {
+            while (!done.load(std::memory_order_acquire))
+            {
+                auto snap = controller.snapshot();
+                if (taken.empty() || snap.size() != taken.back().size())
+                    taken.push_back(std::move(snap));
+                std::this_thread::yield();
+            }
+        });
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            controller.spawn(1.0, 5.0);
+        }
+        done.store(true, std::memory_order_release);
+        reader.join();
+
+        const auto &spheres = controller.agg.objects;
+        const std::vector<Sphere> grown(spheres.cbegin(), spheres.cend());
+        for (const auto &snap : taken)
+        {
+            report.check(snap.epoch() == controller.snapshot().epoch(), "snapshot of another epoch");
+            report.check(!snap.empty() && matches(snap, grown), "snapshot differs from the aggregate prefix");
+        }
+        report.check(matches(controller.snapshot(), grown) && controller.snapshot().size() == grown.size(),
+                     "final snapshot differs from the aggregate");
+
+        // The snapshot of the previous round survives the reset
+        report.check(previous.size() == previousSpheres.size() && matches(previous, previousSpheres),
+                     "snapshot changed by a reset");
+        previous = controller.snapshot();
+        previousSpheres = grown;
+    }
+
+    return report.summary();
+}
+
+// Voxel grids of fuzzed clumps of spheres checked voxel by voxel, and the analysis of a single
+// sphere against its exact volume and area
+int validateAnalysis(const Options &options)
+{
+    Report report{"analysis"};
+    std::mt19937_64 gen{options.seed};
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    const auto count = std::min<std::size_t>(options.size, 60);
+    for (int round = 0; round < options.rounds; ++round)
+    {
+        // Overlapping spheres in a small box, enclosing a few pores
+        std::vector<Sphere> spheres{};
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            spheres.push_back({{6 * unit(gen) - 3, 6 * unit(gen) - 3, 6 * unit(gen) - 3}, 0.3 + 1.2 * unit(gen)});
+        }
+        const auto voxel = 0.1 + 0.2 * unit(gen);
+        auto grid = Agg::Analysis::voxelize(spheres, voxel, 1 + round % 4);
+        Agg::Analysis::markExterior(grid);
+
+        // Solid voxels, the centers on a sphere surface being left to the rounding
+        std::size_t wrong = 0;
+        for (std::size_t z = 0; z < grid.nz; ++z)
+            for (std::size_t y = 0; y < grid.ny; ++y)
+                for (std::size_t x = 0; x < grid.nx; ++x)
+                {
+                    const auto c = grid.center(x, y, z);
+                    bool inside = false, tie = false;
+                    for (const auto &s : spheres)
+                    {
+                        const auto dist = (c - s.coord).Length();
+                        inside = inside || dist <= s.radius;
+                        tie = tie || std::abs(dist - s.radius) < 1e-9;
+                    }
+                    wrong += !tie && inside != grid.isSolid(x, y, z);
+                }
+        report.check(wrong == 0, std::to_string(wrong) + " voxels solid differently from the spheres");
+
+        // Exterior voxels by a breadth first search from a corner, and the faces they share
+        const auto index = [&grid](std::size_t x, std::size_t y, std::size_t z) { return (z * grid.ny + y) * grid.nx + x; };
+        std::vector<char> reached(grid.nx * grid.ny * grid.nz, 0);
+        std::vector<std::size_t> pending{0};
+        reached[0] = 1;
+        std::size_t faces = 0, exteriorFaces = 0;
+        while (!pending.empty())
+        {
+            const auto i = pending.back();
+            pending.pop_back();
+            const std::size_t x = i % grid.nx, y = i / grid.nx % grid.ny, z = i / grid.nx / grid.ny;
+            const std::size_t next[6][3] = {{x - 1, y, z}, {x + 1, y, z}, {x, y - 1, z},
+                                            {x, y + 1, z}, {x, y, z - 1}, {x, y, z + 1}};
+            for (const auto &n : next)
+            {
+                // Out of the grid through the unsigned wrap around too
+                if (n[0] >= grid.nx || n[1] >= grid.ny || n[2] >= grid.nz)
+                    continue;
+                const auto j = index(n[0], n[1], n[2]);
+                if (!reached[j] && !grid.isSolid(n[0], n[1], n[2]))
+                {
+                    reached[j] = 1;
+                    pending.push_back(j);
+                }
+            }
+        }
+
+        wrong = 0;
+        for (std::size_t z = 0; z < grid.nz; ++z)
+            for (std::size_t y = 0; y < grid.ny; ++y)
+                for (std::size_t x = 0; x < grid.nx; ++x)
+                {
+                    wrong += (reached[index(x, y, z)] != 0) != grid.isExterior(x, y, z);
+                    if (!grid.isSolid(x, y, z))
+                        continue;
+                    const std::size_t next[6][3] = {{x - 1, y, z}, {x + 1, y, z}, {x, y - 1, z},
+                                                    {x, y + 1, z}, {x, y, z - 1}, {x, y, z + 1}};
+                    for (const auto &n : next)
+                    {
+                        faces += !grid.isSolid(n[0], n[1], n[2]);
+                        exteriorFaces += reached[index(n[0], n[1], n[2])];
+                    }
+                }
+        report.check(wrong == 0, std::to_string(wrong) + " voxels exterior differently from the search");
+
+        // The analysis counts the same faces, whatever the number of threads
+        Agg::Analysis::Result result{}, single{};
+        report.check(Agg::Analysis::analyze(spheres, voxel, result, 20, 1 + round % 4) == 0 &&
+                         Agg::Analysis::analyze(spheres, voxel, single, 20, 1) == 0,
+                     "analysis failed");
+        const auto area = voxel * voxel * 2 / 3;
+        report.check(std::abs(result.surface - faces * area) <= 1e-9 * result.surface, "surface differs from the faces");
+        report.check(std::abs(result.accessibleSurface - exteriorFaces * area) <= 1e-9 * result.surface,
+                     "accessible surface differs from the exterior faces");
+        report.check(result.volume == single.volume && result.surface == single.surface &&
+                         result.closedPores == single.closedPores && result.density == single.density,
+                     "analysis depends on the threads");
+    }
+
+    // A single sphere, its area estimated from the faces of the voxels
+    const Sphere ball{{0.3, 0.1, -0.2}, 5.0};
+    Agg::Analysis::Result result{};
+    report.check(Agg::Analysis::analyze({ball}, 0.05, result) == 0, "analysis failed");
+    const auto pi = std::acos(-1.0);
+    const auto volume = 4 * pi / 3 * std::pow(ball.radius, 3), area = 4 * pi * ball.radius * ball.radius;
+    report.check(std::abs(result.volume - volume) < 0.01 * volume, "sphere volume " + std::to_string(result.volume));
+    report.check(std::abs(result.surface - area) < 0.02 * area, "sphere area " + std::to_string(result.surface));
+    report.check(result.accessibleSurface == result.surface && result.closedPores == 0.0, "pores in a sphere");
+    report.check(std::abs(result.porosity) < 0.01, "sphere porosity " + std::to_string(result.porosity));
+
+    return report.summary();
+}
+
+// Archives of fuzzed sphere sets in spawn and Morton order, read back and copied to another
+// archive, against the spheres they were written from
+int validateArchive(const Options &options)
+{
+    Report report{"archive"};
+    std::mt19937_64 gen{options.seed};
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    const auto name = (std::filesystem::temp_directory_path() / ("validate-" + std::to_string(options.seed))).string();
+    const auto written = name + ".aggz", copied = name + "-copy.aggz";
+    for (int round = 0; round < options.rounds; ++round)
+    {
+        const auto depth = std::pow(10.0, std::uniform_real_distribution<double>(0.0, 3.0)(gen));
+        Agg::File::ArchiveOptions archiveOptions{};
+        archiveOptions.quantum = depth * std::pow(10.0, -std::uniform_real_distribution<double>(3.0, 7.0)(gen));
+        archiveOptions.order = round % 2 == 0 ? Agg::File::ArchiveOrder::Spawn : Agg::File::ArchiveOrder::Morton;
+        archiveOptions.blockSize = std::uniform_int_distribution<std::uint32_t>(1, 1000)(gen);
+
+        // A few members, one of them empty
+        std::vector<std::vector<Sphere>> members{};
+        for (int m = 0; m < 3; ++m)
+        {
+            members.push_back(fuzzSpheres(gen, m == 1 ? 0 : options.size, depth));
+        }
+        {
+            Agg::File::ArchiveWriter writer{written, archiveOptions};
+            report.check(writer.is_open(), "archive not created");
+            for (std::size_t m = 0; m < members.size(); ++m)
+            {
+                writer.add(10 + m, members[m]);
+            }
+            report.check(writer.close() == 0, "archive not written");
+        }
+        if (archiveOptions.order == Agg::File::ArchiveOrder::Morton)
+        {
+            for (auto &spheres : members)
+            {
+                Agg::mortonSort(spheres);
+            }
+        }
+
+        // The copy goes through the raw blocks, without decoding them
+        {
+            const Agg::File::ArchiveReader reader{written};
+            Agg::File::ArchiveWriter writer{copied, archiveOptions};
+            for (const auto &member : reader.members())
+            {
+                writer.addRaw(reader.data(), member);
+            }
+            report.check(writer.close() == 0, "archive copy not written");
+        }
+
+        for (const auto &file : {written, copied})
+        {
+            const Agg::File::ArchiveReader reader{file};
+            report.check(reader.is_open(), "archive not read back");
+            report.check(reader.members().size() == members.size(),
+                         "archive with " + std::to_string(reader.members().size()) + " members");
+            if (!reader.is_open() || reader.members().size() != members.size())
+                continue;
+
+            // The version of the header is stored little endian
+            const auto data = reader.data();
+            report.check(data[4] == 1 && data[5] == 0 && data[6] == 0 && data[7] == 0, "header not little endian");
+
+            const auto tolerance = archiveOptions.quantum * (0.5 + 1e-6) + depth * 1e-14;
+            for (std::size_t m = 0; m < members.size(); ++m)
+            {
+                const auto &member = reader.members()[m];
+                report.check(member.id == 10 + m && member.order == archiveOptions.order &&
+                                 member.nbSpheres == members[m].size(),
+                             "member header differs from the written one");
+
+                std::vector<Sphere> spheres{};
+                report.check(reader.read(member, spheres), "member not decoded");
+                report.check(spheres.size() == members[m].size(),
+                             "member with " + std::to_string(spheres.size()) + " spheres instead of " +
+                                 std::to_string(members[m].size()));
+                bool same = spheres.size() == members[m].size();
+                for (std::size_t i = 0; same && i < spheres.size(); ++i)
+                {
+                    const auto &expected = members[m][i];
+                    same = std::abs(spheres[i].radius - expected.radius) <= tolerance;
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        same = same && std::abs(spheres[i].coord[k] - expected.coord[k]) <= tolerance;
+                    }
+                }
+                report.check(same, "spheres read back differ from the written ones");
+            }
+        }
+    }
+    std::filesystem::remove(written);
+    std::filesystem::remove(copied);
+
+    return report.summary();
+}
+
+// Cluster-cluster aggregation in boxes small enough for the clusters to span them, the spheres
+// checked for overlaps between all their periodic images and the size counts against the clusters
+int validateCluster(const Options &options)
+{
+    Report report{"cluster"};
+    Math::seed(options.seed);
+    std::mt19937_64 gen{options.seed};
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    const auto count = std::min<std::size_t>(options.size, 300);
+    std::size_t spanned = 0;
+    for (int round = 0; round < options.rounds; ++round)
+    {
+        Agg::Cluster::Parameters parameters{};
+        parameters.box = 30.0 + 60.0 * unit(gen);
+        parameters.sticking = round % 2 == 0 ? 1.0 : 0.2 + 0.8 * unit(gen);
+        parameters.target = std::uniform_int_distribution<std::size_t>(1, 5)(gen);
+        Agg::Cluster::Engine engine{parameters};
+
+        std::size_t added = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            added += engine.addMonomer(1.0 + unit(gen));
+        }
+        engine.run();
+        spanned += engine.spans();
+        report.check(engine.spans() || engine.size() <= parameters.target, "aggregation stopped early");
+
+        // Periodic overlaps, inside a cluster and between two of them
+        const auto spheres = engine.spheres();
+        report.check(spheres.size() == added, std::to_string(spheres.size()) + " spheres in the clusters instead of " +
+                                                  std::to_string(added));
+        auto worst = std::numeric_limits<double>::infinity();
+        for (std::size_t i = 0; i < spheres.size(); ++i)
+        {
+            for (std::size_t j = i + 1; j < spheres.size(); ++j)
+            {
+                auto d = spheres[i].coord - spheres[j].coord;
+                for (int k = 0; k < 3; ++k)
+                {
+                    d[k] -= parameters.box * std::round(d[k] / parameters.box);
+                }
+                worst = std::min(worst, d.Length() - spheres[i].radius - spheres[j].radius);
+            }
+        }
+        report.check(worst >= -1e-9 * parameters.box, "clustered spheres overlapping by " + std::to_string(-worst));
+
+        // The counts of each size follow the clusters
+        std::map<std::size_t, std::size_t> sizes{};
+        for (const auto size : engine.clusterSizes())
+        {
+            sizes[size] += 1;
+        }
+        report.check(sizes == engine.getSizes(), "size counts differ from the clusters");
+        report.check(engine.clusterSizes().size() == engine.size(), "cluster count differs from the clusters");
+    }
+    if (options.rounds > 3)
+        report.check(spanned > 0, "no cluster spanning its box");
+
+    return report.summary();
+}
+
+struct Statistics
+{
+    std::size_t count = 0;
+    double meanRadius = 0.0;
+    double rg = 0.0;
+    double coordination = 0.0;
+    std::vector<double> distances{}; // To the center of mass, sorted
+    std::vector<double> contacts{};  // Per sphere, sorted
+};
+
+Statistics statistics(const std::vector<Sphere> &spheres, double contact)
+{
+    Statistics stats{};
+    stats.count = spheres.size();
+
+    Vec3d center{};
+    auto maxExtent = 0.0;
+    for (const auto &s : spheres)
+    {
+        center += s.coord;
+        stats.meanRadius += s.radius;
+    }
+    center /= static_cast<double>(spheres.size());
+    stats.meanRadius /= static_cast<double>(spheres.size());
+
+    for (const auto &s : spheres)
+    {
+        const auto dist = (s.coord - center).Length();
+        stats.distances.push_back(dist);
+        stats.rg += dist * dist;
+        maxExtent = std::max(maxExtent, dist + s.radius);
+    }
+    stats.rg = std::sqrt(stats.rg / static_cast<double>(spheres.size()));
+
+    // Index filled and queried by all the threads
+    ConcurrentOctree<Sphere> octree{center, maxExtent};
+    const auto nbThreads = Parallel::concurrency();
+    Parallel::forChunks(spheres.size(), nbThreads, [&](unsigned int, std::size_t first, std::size_t last) {
+        for (auto i = first; i < last; ++i)
+        {
+            octree.insert(spheres[i]);
+        }
+    });
+
+    stats.contacts.resize(spheres.size());
+    Parallel::forChunks(spheres.size(), nbThreads, [&](unsigned int, std::size_t first, std::size_t last) {
+        std::vector<Sphere> found{};
+        for (auto i = first; i < last; ++i)
+        {
+            found.clear();
+            octree.getIntersecting(spheres[i].coord, spheres[i].radius + contact, found);
+            // The sphere finds itself
+            stats.contacts[i] = static_cast<double>(found.size() - 1);
+        }
+    });
+    for (const auto c : stats.contacts)
+    {
+        stats.coordination += c;
+    }
+    stats.coordination /= static_cast<double>(spheres.size());
+
+    std::sort(stats.distances.begin(), stats.distances.end());
+    std::sort(stats.contacts.begin(), stats.contacts.end());
+    return stats;
+}
+
+// Two samples Kolmogorov-Smirnov test, returns the p-value of the samples coming from one distribution
+double kolmogorovSmirnov(const std::vector<double> &lhs, const std::vector<double> &rhs)
+{
+    std::size_t i = 0, j = 0;
+    auto d = 0.0;
+    while (i < lhs.size() && j < rhs.size())
+    {
+        const auto x = std::min(lhs[i], rhs[j]);
+        while (i < lhs.size() && lhs[i] <= x)
+            ++i;
+        while (j < rhs.size() && rhs[j] <= x)
+            ++j;
+        d = std::max(d, std::abs(double(i) / lhs.size() - double(j) / rhs.size()));
+    }
+
+    const auto n = double(lhs.size()) * rhs.size() / (lhs.size() + rhs.size());
+    const auto lambda = (std::sqrt(n) + 0.12 + 0.11 / std::sqrt(n)) * d;
+    if (lambda < 0.2)
+        return 1.0; // The series does not converge, and the samples are not distinguishable
+    auto p = 0.0;
+    for (int k = 1; k <= 100; ++k)
+    {
+        p += 2.0 * (k % 2 ? 1.0 : -1.0) * std::exp(-2.0 * k * k * lambda * lambda);
+    }
+    return std::clamp(p, 0.0, 1.0);
+}
+
+// Whether two aggregates, e.g. grown by different engine modes, share their statistics
+int compare(const Options &options, const std::string &lhsFile, const std::string &rhsFile)
+{
+    std::vector<Sphere> lhsSpheres{}, rhsSpheres{};
+    if (Agg::File::load(lhsFile, lhsSpheres) != 0 || Agg::File::load(rhsFile, rhsSpheres) != 0)
+        return 2;
+    if (lhsSpheres.size() < 2 || rhsSpheres.size() < 2)
+    {
+        std::cerr << "Cannot compare aggregates of less than two spheres" << std::endl;
+        return 2;
+    }
+
+    const auto lhs = statistics(lhsSpheres, options.contact);
+    const auto rhs = statistics(rhsSpheres, options.contact);
+
+    std::cout << "                  " << lhsFile << " | " << rhsFile << '\n'
+              << "Spheres           " << lhs.count << " | " << rhs.count << '\n'
+              << "Mean radius       " << lhs.meanRadius << " | " << rhs.meanRadius << '\n'
+              << "Radius of gyration " << lhs.rg << " | " << rhs.rg << '\n'
+              << "Coordination      " << lhs.coordination << " | " << rhs.coordination << '\n';
+
+    const auto pDistances = kolmogorovSmirnov(lhs.distances, rhs.distances);
+    const auto pContacts = kolmogorovSmirnov(lhs.contacts, rhs.contacts);
+    std::cout << "Radial distribution p-value " << pDistances << '\n'
+              << "Contacts distribution p-value " << pContacts << std::endl;
+
+    if (pDistances < options.alpha || pContacts < options.alpha)
+    {
+        std::cout << "Different at level " << options.alpha << std::endl;
+        return 1;
+    }
+    std::cout << "Compatible at level " << options.alpha << std::endl;
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"seed", required_argument, NULL, 50},
+        {"rounds", required_argument, NULL, 51},
+        {"size", required_argument, NULL, 52},
+        {"alpha", required_argument, NULL, 53},
+        {"contact", required_argument, NULL, 54},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}};
+
+    Options options{};
+    // The options follow the command, a leading help flag is not one
+    bool do_help = argc < 2 || std::string{argv[1]} == "-h" || std::string{argv[1]} == "--help";
+
+    int c;
+    while (!do_help && (c = getopt_long(argc - 1, argv + 1, "h", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 50:
+            options.seed = std::stoul(optarg);
+            break;
+        case 51:
+            options.rounds = std::stoi(optarg);
+            break;
+        case 52:
+            options.size = std::stoul(optarg);
+            break;
+        case 53:
+            options.alpha = std::stod(optarg);
+            break;
+        case 54:
+            options.contact = std::stod(optarg);
+            break;
+        case 'h':
+            do_help = true;
+            break;
+        default:
+            std::cerr << "Use '--help' or '-h' for usage " << std::endl;
+            return 2;
+        }
+    }
+
+    if (do_help)
+    {
+        std::cout << "Usage: validate index|controller|snapshot|analysis|archive|cluster|all [options]\n"
+                  << "       validate compare FILE FILE [options]\n"
+                  << "Options:\n"
+                  << "[--seed N]        Seed of the fuzzed inputs (default : 1)\n"
+                  << "[--rounds N]      Fuzzed sets to check (default : 20)\n"
+                  << "[--size N]        Spheres per set (default : 2000)\n"
+                  << "[--alpha LEVEL]   Significance level of compare (default : 0.01)\n"
+                  << "[--contact DIST]  Largest gap of a contact for compare (default : 0.05)\n"
+                  << '\n';
+        return 0;
+    }
+
+    const std::string command{argv[1]};
+    const auto nbFiles = argc - 1 - optind;
+    if (command == "compare" && nbFiles == 2)
+        return compare(options, argv[optind + 1], argv[optind + 2]);
+    if (nbFiles == 0)
+    {
+        if (command == "index")
+            return validateIndex(options);
+        if (command == "controller")
+            return validateController(options);
+        if (command == "snapshot")
+            return validateSnapshot(options);
+        if (command == "analysis")
+            return validateAnalysis(options);
+        if (command == "archive")
+            return validateArchive(options);
+        if (command == "cluster")
+            return validateCluster(options);
+        if (command == "all")
+            return validateIndex(options) | validateController(options) | validateSnapshot(options) |
+                   validateAnalysis(options) | validateArchive(options) | validateCluster(options);
+    }
+
+    std::cerr << "Use '--help' or '-h' for usage " << std::endl;
+    return 2;
+}
\ No newline at end of file